@@ -8,13 +8,38 @@ LICENSE file in the root directory of this source tree.
 
 #include "ce_json.h"
 
+#include <tuple>
 #include <utility>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+
+static void* mallocNode(size_t size, void* user) {
+	return malloc(size);
+}
+
+static void freeNode(void* ptr, void* user) {
+	free(ptr);
+}
+
+static ceJSONAllocator g_allocator = { mallocNode, freeNode, nullptr };
+
+void ceJSONSetAllocator(const ceJSONAllocator* allocator) {
+	g_allocator = allocator ? *allocator : ceJSONAllocator{ mallocNode, freeNode, nullptr };
+}
+
+void* ceJSONAllocNode() {
+	return g_allocator.alloc(sizeof(ceJSON), g_allocator.user);
+}
+
+void ceJSONFreeNode(ceJSON* json) {
+	g_allocator.free(json, g_allocator.user);
+}
 
 struct Parser {
 	const char* at;
 	const char* end;
+	int depth;
 };
 
 static bool parseNode(Parser* p, ceJSON* json);
@@ -28,16 +53,12 @@ static bool isWhiteSpace(char c) {
 
 static std::pair<bool, char> nextChar(Parser* p) {
 
-	char c;
-	for (;;) {
-		c = p->at++[0];
-		if (!isWhiteSpace(c)) break;
-	}
+	while (p->at < p->end && isWhiteSpace(p->at[0])) p->at++;
 
 	if (p->at >= p->end)
 		return { false, 0 };
 
-	return { true, c };
+	return { true, p->at++[0] };
 }
 
 static std::tuple<bool, const char*, const char*> nextRange(Parser* p, int len) {
@@ -45,7 +66,7 @@ static std::tuple<bool, const char*, const char*> nextRange(Parser* p, int len)
 	const char* start = p->at;
 	const char* end = p->at + len;
 
-	if (end >= p->end) {
+	if (end > p->end) {
 		return { false, nullptr, nullptr };
 	}
 
@@ -55,16 +76,83 @@ static std::tuple<bool, const char*, const char*> nextRange(Parser* p, int len)
 
 }
 
+/* Returns the closing quote of the string whose contents start at `at`, or `end` if it is not closed before it */
+static const char* findStringEnd(const char* at, const char* end) {
+
+	while (at < end) {
+		if (at[0] == '\\') {
+			at += 2;
+			continue;
+		}
+
+		if (at[0] == '"') return at;
+		at++;
+	}
+
+	return end;
+}
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+const char* ceJSONParseNumber(const char* at, const char* end, double* value) {
+
+	const char* c = at;
+	if (c < end && c[0] == '-') c++;
+
+	if (c >= end || !isDigit(c[0])) return nullptr;
+
+	// No leading zeros
+	if (c[0] == '0') {
+		c++;
+	}
+	else {
+		while (c < end && isDigit(c[0])) c++;
+	}
+
+	if (c < end && c[0] == '.') {
+		const char* fraction = ++c;
+		while (c < end && isDigit(c[0])) c++;
+		if (c == fraction) return nullptr;
+	}
+
+	if (c < end && (c[0] == 'e' || c[0] == 'E')) {
+		c++;
+		if (c < end && (c[0] == '+' || c[0] == '-')) c++;
+
+		const char* exponent = c;
+		while (c < end && isDigit(c[0])) c++;
+		if (c == exponent) return nullptr;
+	}
+
+	// strtod needs a terminated copy, the buffer may end right after the number
+	char tmp[64];
+	size_t len = c - at;
+	char* copy = len < sizeof(tmp) ? tmp : (char*)malloc(len + 1);
+	if (copy == nullptr) return nullptr;
+
+	memcpy(copy, at, len);
+	copy[len] = 0;
+
+	*value = strtod(copy, nullptr);
+
+	if (copy != tmp) free(copy);
+
+	return c;
+}
+
+// Strings and keys are views of the raw text between the quotes, escape sequences are skipped over
+// but not decoded
 static std::pair<bool, std::string_view> parseString(Parser* p, ceJSON* json) {
 
 	const char* start = p->at;
-	for (;;) {
-		auto [s, c] = nextChar(p);
-		if (!s) return { false, {} };
-		if (c == '"') break;
-	}
+	const char* close = findStringEnd(p->at, p->end);
+	if (close >= p->end) return { false, {} };
 
-	std::string_view string(start, p->at - 1);
+	p->at = close + 1;
+
+	std::string_view string(start, close - start);
 
 	if (json != nullptr) {
 		json->kind = ceJSONKind::string;
@@ -78,14 +166,19 @@ static bool parseObject(Parser* p, ceJSON* json, bool hasKey) {
 
 	json->kind = hasKey ? ceJSONKind::object : ceJSONKind::array;
 
-	char end_char = hasKey ? '}' : '[';
+	char end_char = hasKey ? '}' : ']';
+
+	// Empty container
+	while (p->at < p->end && isWhiteSpace(p->at[0])) p->at++;
+	if (p->at < p->end && p->at[0] == end_char) {
+		p->at++;
+		return true;
+	}
 
 	ceJSON* prev = nullptr;
 	for (;;) {
-		auto [s, c] = nextChar(p);
-		if (!s) return false;
-
-		auto next_json = (ceJSON*)malloc(sizeof(*json));
+		auto next_json = (ceJSON*)ceJSONAllocNode();
+		if (next_json == nullptr) return false;
 		memset(next_json, 0, sizeof(*next_json));
 
 		if (json->first_child == nullptr)
@@ -95,38 +188,25 @@ static bool parseObject(Parser* p, ceJSON* json, bool hasKey) {
 			prev->next = next_json;
 
 		if (hasKey) {
-			if (c != '"') return false;
+			auto [s, c] = nextChar(p);
+			if (!s || c != '"') return false;
+
 			auto [succ, str] = parseString(p, nullptr);
 			if (!succ) return false;
 
 			next_json->key = str;
 
 			std::tie(s, c) = nextChar(p);
-			if (!s) return false;
-
-			if (c != ':') return false;
-		}
-		else {
-			// HACK: Move pointer back one.
-			// TODO: Define a more precise meaning where the `at` ptr should
-			// be point to. Is it the next char or is it the current one ?
-			// Should a number parser not expect to be on the first number it receives ?
-			p->at--;
+			if (!s || c != ':') return false;
 		}
-		
-		parseNode(p, next_json);
 
-		std::tie(s, c) = nextChar(p);
+		if (!parseNode(p, next_json)) return false;
+
+		auto [s, c] = nextChar(p);
 		if (!s) return false;
 
-		if (c != ',') {
-			if (c != end_char) {
-				return false;
-			}
-			else {
-				break;
-			}
-		}
+		if (c == end_char) break;
+		if (c != ',') return false;
 
 		prev = next_json;
 	}
@@ -180,8 +260,14 @@ static bool parseLiteral(Parser* p, ceJSON* json, char begin_char) {
 
 static bool parseNumber(Parser* p, ceJSON* json) {
 
+	// The first char was already taken by parseNode
 	p->at--;
-	double value = strtod(p->at, (char**)&p->at);
+
+	double value;
+	const char* next = ceJSONParseNumber(p->at, p->end, &value);
+	if (next == nullptr) return false;
+
+	p->at = next;
 
 	if (json != nullptr) {
 		json->kind = ceJSONKind::number;
@@ -199,18 +285,20 @@ bool parseNode(Parser* p, ceJSON* json) {
 	switch (c) {
 
 	case '{':
-		parseObject(p, json, true);
-		break;
+	case '[': {
+		// Same limit as the stream parser, which keeps the recursion bounded as well
+		if (p->depth == ceJSONStreamMaxDepth) return false;
 
-	case '[':
-		parseObject(p, json, false);
-		break;
+		p->depth++;
+		bool result = parseObject(p, json, c == '{');
+		p->depth--;
+
+		return result;
+	}
 
 	case '"':
-		parseString(p, json);
-		break;
+		return parseString(p, json).first;
 
-	case '+':
 	case '-':
 	case '0':
 	case '1':
@@ -222,21 +310,16 @@ bool parseNode(Parser* p, ceJSON* json) {
 	case '7':
 	case '8':
 	case '9':
-		parseNumber(p, json);
-		break;
+		return parseNumber(p, json);
 
 	case 'f':
 	case 'n':
 	case 't':
-		parseLiteral(p, json, c);
-		break;
+		return parseLiteral(p, json, c);
 
 	default:
 		return false;
-		break;
 	}
-
-	return true;
 }
 
 ceJSON* ceJSONParse(const char* buffer, size_t len) {
@@ -247,21 +330,59 @@ ceJSON* ceJSONParse(const char* buffer, size_t len) {
 	};
 
 
-	ceJSON* root = (ceJSON*)malloc(sizeof(ceJSON));
+	ceJSON* root = (ceJSON*)ceJSONAllocNode();
 	if (root == nullptr) {
 		return nullptr;
 	}
 
 	memset(root, 0, sizeof(*root));
 
-	parseNode(&p, root);
+	// Only whitespace may follow the root value
+	bool valid = parseNode(&p, root);
+	if (valid) {
+		auto [s, c] = nextChar(&p);
+		valid = !s;
+	}
+
+	if (!valid) {
+		ceJSONFree(root);
+		return nullptr;
+	}
 
 	return root;
 }
 
+void ceJSONFree(ceJSON* json) {
+
+	ceJSON* node = json->first_child;
+	while (node) {
+		ceJSON* next = node->next;
+		ceJSONFree(node);
+		node = next;
+	}
+
+	ceJSONFreeNode(json);
+}
+
+size_t ceJSONParseValue(const char* buffer, size_t len, ceJSON* json) {
+
+	Parser p = {
+		.at = buffer,
+		.end = buffer + len,
+	};
+
+	memset(json, 0, sizeof(*json));
+
+	if (!parseNode(&p, json)) {
+		return 0;
+	}
+
+	return p.at - buffer;
+}
+
 ceJSON* ceJSONGetByKey(ceJSON* json, const char* buffer) {
 
-	if (json->kind != ceJSONKind::object) {
+	if (json == nullptr || json->kind != ceJSONKind::object) {
 		return nullptr; /* must be a object otherwise we can not iterate over the keys inside it */
 	}
 
@@ -311,4 +432,271 @@ size_t ceJSONLen(ceJSON* json) {
 	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+enum StreamState {
+	stream_root_value,
+	stream_first_value_or_end, /* right after '[' */
+	stream_first_key_or_end,   /* right after '{' */
+	stream_comma_or_end,
+	stream_done,
+	stream_failed,
+};
+
+enum class StreamToken {
+	ok,
+	incomplete,
+	error,
+};
+
+bool ceJSONStreamInit(ceJSONStream* s, size_t window_size) {
+
+	memset(s, 0, sizeof(*s));
+
+	s->window = (char*)malloc(window_size);
+	if (s->window == nullptr) {
+		return false;
+	}
+
+	s->capacity = window_size;
+	s->state = stream_root_value;
+
+	return true;
+}
+
+void ceJSONStreamFree(ceJSONStream* s) {
+	free(s->window);
+	memset(s, 0, sizeof(*s));
+}
+
+size_t ceJSONStreamFeed(ceJSONStream* s, const char* buffer, size_t len) {
+
+	if (s->at > 0) {
+		memmove(s->window, s->window + s->at, s->len - s->at);
+		s->len -= s->at;
+		s->at = 0;
+	}
+
+	size_t accepted = s->capacity - s->len;
+	if (accepted > len) accepted = len;
+
+	memcpy(s->window + s->len, buffer, accepted);
+	s->len += accepted;
+
+	return accepted;
+}
+
+void ceJSONStreamEnd(ceJSONStream* s) {
+	s->eof = true;
+}
+
+static const char* streamSkipWhiteSpace(const char* at, const char* end) {
+	while (at < end && isWhiteSpace(at[0])) at++;
+	return at;
+}
+
+/* Scans the string starting at the opening quote, on success `at` is moved past the closing quote */
+static StreamToken streamString(const char** at, const char* end, std::string_view* string) {
+
+	const char* c = findStringEnd(*at + 1, end);
+	if (c >= end) return StreamToken::incomplete;
+
+	*string = std::string_view(*at + 1, c);
+	*at = c + 1;
+
+	return StreamToken::ok;
+}
+
+static bool isNumberChar(char c) {
+	return (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E';
+}
+
+static StreamToken streamNumber(ceJSONStream* s, const char** at, const char* end, double* number) {
+
+	const char* c = *at;
+	while (c < end && isNumberChar(c[0])) c++;
+
+	// The number might continue in the next feed
+	if (c >= end && !s->eof) return StreamToken::incomplete;
+
+	const char* next = ceJSONParseNumber(*at, c, number);
+	if (next == nullptr) return StreamToken::error;
+
+	*at = next;
+
+	return StreamToken::ok;
+}
+
+static StreamToken streamLiteral(ceJSONStream* s, const char** at, const char* end, ceJSONEvent* event) {
+
+	const char* literal = nullptr;
+	size_t length = 0;
+
+	switch ((*at)[0]) {
+	case 't': literal = "true"; length = 4; event->kind = ceJSONEventKind::boolean; event->boolean = true; break;
+	case 'f': literal = "false"; length = 5; event->kind = ceJSONEventKind::boolean; event->boolean = false; break;
+	case 'n': literal = "null"; length = 4; event->kind = ceJSONEventKind::null; break;
+	default: return StreamToken::error;
+	}
+
+	if ((size_t)(end - *at) < length) {
+		return s->eof ? StreamToken::error : StreamToken::incomplete;
+	}
+
+	if (memcmp(*at, literal, length) != 0) return StreamToken::error;
+	*at += length;
+
+	return StreamToken::ok;
+}
+
+static StreamToken streamValue(ceJSONStream* s, const char** at, const char* end, ceJSONEvent* event) {
+
+	const char* c = streamSkipWhiteSpace(*at, end);
+	if (c >= end) return StreamToken::incomplete;
+
+	event->depth = s->depth;
+
+	StreamToken result = StreamToken::ok;
+	switch (c[0]) {
+
+	case '{':
+	case '[':
+		if (s->depth == ceJSONStreamMaxDepth) return StreamToken::error;
+
+		event->kind = c[0] == '{' ? ceJSONEventKind::object_begin : ceJSONEventKind::array_begin;
+		s->stack[s->depth++] = c[0] == '{' ? ceJSONKind::object : ceJSONKind::array;
+		s->state = c[0] == '{' ? stream_first_key_or_end : stream_first_value_or_end;
+		*at = c + 1;
+		return StreamToken::ok;
+
+	case '"':
+		event->kind = ceJSONEventKind::string;
+		result = streamString(&c, end, &event->string);
+		break;
+
+	case 't':
+	case 'f':
+	case 'n':
+		result = streamLiteral(s, &c, end, event);
+		break;
+
+	default:
+		if (!isNumberChar(c[0])) return StreamToken::error;
+
+		event->kind = ceJSONEventKind::number;
+		result = streamNumber(s, &c, end, &event->number);
+		break;
+	}
+
+	if (result != StreamToken::ok) return result;
+
+	s->state = s->depth == 0 ? stream_done : stream_comma_or_end;
+	*at = c;
+
+	return StreamToken::ok;
+}
+
+static StreamToken streamKeyAndValue(ceJSONStream* s, const char** at, const char* end, ceJSONEvent* event) {
+
+	const char* c = streamSkipWhiteSpace(*at, end);
+	if (c >= end) return StreamToken::incomplete;
+	if (c[0] != '"') return StreamToken::error;
+
+	StreamToken result = streamString(&c, end, &event->key);
+	if (result != StreamToken::ok) return result;
+
+	c = streamSkipWhiteSpace(c, end);
+	if (c >= end) return StreamToken::incomplete;
+	if (c[0] != ':') return StreamToken::error;
+	c++;
+
+	result = streamValue(s, &c, end, event);
+	if (result != StreamToken::ok) return result;
+
+	*at = c;
+
+	return StreamToken::ok;
+}
+
+static StreamToken streamContainerEnd(ceJSONStream* s, const char** at, ceJSONEvent* event) {
+
+	ceJSONKind kind = s->stack[s->depth - 1];
+	if ((*at)[0] != (kind == ceJSONKind::object ? '}' : ']')) return StreamToken::error;
+
+	s->depth--;
+	event->kind = kind == ceJSONKind::object ? ceJSONEventKind::object_end : ceJSONEventKind::array_end;
+	event->depth = s->depth;
+	s->state = s->depth == 0 ? stream_done : stream_comma_or_end;
+	*at += 1;
+
+	return StreamToken::ok;
+}
+
+static StreamToken streamNext(ceJSONStream* s, const char** at, const char* end, ceJSONEvent* event) {
+
+	switch (s->state) {
+
+	case stream_root_value:
+		return streamValue(s, at, end, event);
+
+	case stream_first_value_or_end:
+		if ((*at)[0] == ']') return streamContainerEnd(s, at, event);
+		return streamValue(s, at, end, event);
+
+	case stream_first_key_or_end:
+		if ((*at)[0] == '}') return streamContainerEnd(s, at, event);
+		return streamKeyAndValue(s, at, end, event);
+
+	case stream_comma_or_end: {
+		if ((*at)[0] != ',') return streamContainerEnd(s, at, event);
+
+		const char* c = *at + 1;
+		StreamToken result = s->stack[s->depth - 1] == ceJSONKind::object ? streamKeyAndValue(s, &c, end, event)
+																		  : streamValue(s, &c, end, event);
+		if (result == StreamToken::ok) *at = c;
+		return result;
+	}
+
+	default:
+		return StreamToken::error;
+	}
+}
+
+ceJSONStreamResult ceJSONStreamNext(ceJSONStream* s, ceJSONEvent* event) {
+
+	if (s->state == stream_failed) {
+		return ceJSONStreamResult::error;
+	}
+
+	// Whitespace between tokens can always be dropped, even when the token after it is incomplete
+	const char* end = s->window + s->len;
+	const char* at = streamSkipWhiteSpace(s->window + s->at, end);
+	s->at = at - s->window;
+
+	if (s->state == stream_done) {
+		if (at < end) {
+			s->state = stream_failed; /* trailing data after the root value */
+			return ceJSONStreamResult::error;
+		}
+
+		return s->eof ? ceJSONStreamResult::done : ceJSONStreamResult::need_more;
+	}
+
+	memset(event, 0, sizeof(*event));
+
+	StreamToken result = at < end ? streamNext(s, &at, end, event) : StreamToken::incomplete;
+
+	if (result == StreamToken::ok) {
+		s->at = at - s->window;
+		return ceJSONStreamResult::event;
+	}
+
+	// A token which does not fit into the window will never complete
+	bool window_full = s->at == 0 && s->len == s->capacity;
+	if (result == StreamToken::error || s->eof || window_full) {
+		s->state = stream_failed;
+		return ceJSONStreamResult::error;
+	}
+
+	return ceJSONStreamResult::need_more;
+}
@@ -6,6 +6,8 @@ This source code is licensed under the BSD-style license found in the
 LICENSE file in the root directory of this source tree.
 */
 
+#pragma once
+
 #include <string_view>
 
 enum class ceJSONKind {
@@ -19,7 +21,8 @@ enum class ceJSONKind {
 
 struct ceJSON {
 	ceJSONKind kind;
-	
+
+	// Views into the parsed buffer, escape sequences are not decoded
 	std::string_view key;
 
 	std::string_view string;
@@ -30,9 +33,32 @@ struct ceJSON {
 	ceJSON* next;
 };
 
+// Returns nullptr if the buffer is not exactly one JSON value, surrounding whitespace aside
 ceJSON* ceJSONParse(const char* buffer, size_t len);
+void ceJSONFree(ceJSON* json);
+
+// Allocator for the tree nodes, malloc/free unless set. It is global and not synchronized, only
+// change it while no parse is running. With an arena `free` can be a no-op and the whole tree is
+// released at once by the owner of the arena.
+struct ceJSONAllocator {
+	void* (*alloc)(size_t size, void* user);
+	void (*free)(void* ptr, void* user);
+	void* user;
+};
+
+void ceJSONSetAllocator(const ceJSONAllocator* allocator); /* nullptr restores malloc/free */
+void* ceJSONAllocNode();
+void ceJSONFreeNode(ceJSON* json);
+
+// Parses the single value at the start of `buffer` into `json`. Returns the number of bytes
+// consumed or 0 on failure. Used by parsers which only need the generic tree for parts of a document.
+size_t ceJSONParseValue(const char* buffer, size_t len, ceJSON* json);
 ceJSON* ceJSONGetByKey(ceJSON* json, const char* buffer);
 
+// Parses the JSON number at the start of [at, end) without reading past `end`. Returns the end of
+// the number or nullptr if there is none. All parsers go through this so they agree on every value.
+const char* ceJSONParseNumber(const char* at, const char* end, double* value);
+
 struct ceJSONIterator {
 	ceJSON* json;
 	ceJSON* node;
@@ -42,4 +68,63 @@ ceJSONIterator ceJSONIterBegin(ceJSON* obj);
 bool ceJSONIterValid(ceJSONIterator* iter);
 void ceJSONIterNext(ceJSONIterator* iter);
 
-size_t ceJSONLen(ceJSON* json);
\ No newline at end of file
+size_t ceJSONLen(ceJSON* json);
+
+// Incremental parser for documents which do not fit into memory or arrive in pieces. Input is fed
+// into a fixed size window and parsed into a flat stream of events, tokens straddling two feeds are
+// kept in the window until they are complete. Memory use is bounded by the window size and the
+// maximum nesting depth, a single token (key and value) has to fit into the window.
+
+enum class ceJSONEventKind {
+	object_begin,
+	object_end,
+	array_begin,
+	array_end,
+	null,
+	boolean,
+	number,
+	string,
+};
+
+struct ceJSONEvent {
+	ceJSONEventKind kind;
+	int depth; /* 0 for the root value */
+
+	// Views into the stream window, only valid until the next ceJSONStreamFeed
+	std::string_view key;
+	std::string_view string;
+
+	double number;
+	bool boolean;
+};
+
+enum class ceJSONStreamResult {
+	event,
+	need_more, /* feed more input or call ceJSONStreamEnd */
+	done,
+	error,
+};
+
+static const int ceJSONStreamMaxDepth = 256;
+
+struct ceJSONStream {
+	char* window;
+	size_t capacity;
+	size_t at;
+	size_t len;
+	bool eof;
+
+	int state;
+	int depth;
+	ceJSONKind stack[ceJSONStreamMaxDepth];
+};
+
+bool ceJSONStreamInit(ceJSONStream* s, size_t window_size);
+void ceJSONStreamFree(ceJSONStream* s);
+
+// Returns how many bytes were taken, which is less than `len` once the window is full.
+// Pull events in that case and feed the remainder afterwards.
+size_t ceJSONStreamFeed(ceJSONStream* s, const char* buffer, size_t len);
+void ceJSONStreamEnd(ceJSONStream* s);
+
+ceJSONStreamResult ceJSONStreamNext(ceJSONStream* s, ceJSONEvent* event);
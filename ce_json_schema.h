@@ -0,0 +1,379 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#pragma once
+
+#include "ce_json.h"
+
+#include <iterator>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Specialized parser for arrays of flat records with a layout known at compile time, e.g.
+//
+//   static constexpr ceJSONField pairFields[] = {
+//       CE_JSON_FIELD(HaversinePair, x0),
+//       CE_JSON_FIELD(HaversinePair, y0),
+//   };
+//   using PairSchema = ceJSONSchema<HaversinePair, pairFields>;
+//
+// Every field is a number stored as a double at the given offset. Records whose keys come exactly
+// in schema order are decoded straight into the struct, keys are matched by their precomputed
+// length and first 8 bytes. Anything else (other key order, unknown keys, other value kinds) is
+// handed to the generic tree parser for that one record.
+
+struct ceJSONField {
+	const char* name;
+	size_t name_len;
+	uint64_t prefix; /* first (up to) 8 bytes of the name, little endian */
+	uint64_t prefix_mask;
+	size_t offset;
+};
+
+constexpr ceJSONField ceJSONMakeField(const char* name, size_t offset) {
+
+	ceJSONField field = {};
+	field.name = name;
+	field.offset = offset;
+
+	while (name[field.name_len]) field.name_len++;
+
+	for (size_t i = 0; i < field.name_len && i < 8; i++) {
+		field.prefix |= (uint64_t)(uint8_t)name[i] << (8*i);
+		field.prefix_mask |= (uint64_t)0xFF << (8*i);
+	}
+
+	return field;
+}
+
+#define CE_JSON_FIELD(type, member) ceJSONMakeField(#member, offsetof(type, member))
+#define CE_JSON_FIELD_NAMED(type, member, name) ceJSONMakeField(name, offsetof(type, member))
+
+struct ceJSONSchemaStats {
+	size_t fast_count;
+	size_t generic_count;
+};
+
+template <typename T, const auto& Fields>
+struct ceJSONSchema {
+
+	static constexpr size_t field_count = std::size(Fields);
+
+	static bool isWhiteSpace(char c) {
+		return (c == ' '  ||
+				c == '\n' ||
+				c == '\t' ||
+				c == '\r');
+	}
+
+	static const char* skipWhiteSpace(const char* at, const char* end) {
+		while (at < end && isWhiteSpace(at[0])) at++;
+		return at;
+	}
+
+	// Exact for plain decimals with at most 15 significant digits: both the mantissa and the power
+	// of ten are exactly representable, so the single division is correctly rounded and gives the
+	// same double as strtod. Everything else (exponents, long mantissas, leading zeros, numbers
+	// running up to `end`) is left to ceJSONParseNumber.
+	static const char* parseNumber(const char* at, const char* end, double* value) {
+
+		static constexpr double pow10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		};
+
+		const char* c = at;
+		bool negative = c < end && c[0] == '-';
+		if (negative) c++;
+
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int fraction_digits = 0;
+
+		const char* int_start = c;
+		while (c < end && c[0] >= '0' && c[0] <= '9') {
+			mantissa = mantissa*10 + (c[0] - '0');
+			digits++;
+			c++;
+		}
+
+		bool valid = c != int_start && (int_start[0] != '0' || c == int_start + 1);
+		if (valid && c < end && c[0] == '.') {
+			c++;
+			const char* fraction_start = c;
+			while (c < end && c[0] >= '0' && c[0] <= '9') {
+				mantissa = mantissa*10 + (c[0] - '0');
+				digits++;
+				fraction_digits++;
+				c++;
+			}
+			valid = c != fraction_start;
+		}
+
+		bool exponent = c < end && (c[0] == 'e' || c[0] == 'E');
+		if (!valid || exponent || digits > 15 || c >= end) {
+			return ceJSONParseNumber(at, end, value);
+		}
+
+		double result = (double)mantissa / pow10[fraction_digits];
+		*value = negative ? -result : result;
+
+		return c;
+	}
+
+	static bool matchKey(const char* at, const char* end, const ceJSONField& field) {
+
+		// The key plus its closing quote has to fit
+		if ((size_t)(end - at) <= field.name_len) return false;
+		if (at[field.name_len] != '"') return false;
+
+		if ((size_t)(end - at) >= 8) {
+			uint64_t prefix;
+			memcpy(&prefix, at, sizeof(prefix));
+			if ((prefix & field.prefix_mask) != field.prefix) return false;
+		}
+		else if (memcmp(at, field.name, field.name_len < 8 ? field.name_len : 8) != 0) {
+			return false;
+		}
+
+		return field.name_len <= 8 || memcmp(at + 8, field.name + 8, field.name_len - 8) == 0;
+	}
+
+	/* Returns nullptr if the record is not in the expected layout, nothing is consumed in that case */
+	static const char* parseRecordFast(const char* at, const char* end, T* record) {
+
+		at = skipWhiteSpace(at, end);
+		if (at >= end || at[0] != '{') return nullptr;
+		at++;
+
+		for (size_t i = 0; i < field_count; i++) {
+			const ceJSONField& field = Fields[i];
+
+			at = skipWhiteSpace(at, end);
+			if (at >= end || at[0] != '"') return nullptr;
+			at++;
+
+			if (!matchKey(at, end, field)) return nullptr;
+			at += field.name_len + 1;
+
+			at = skipWhiteSpace(at, end);
+			if (at >= end || at[0] != ':') return nullptr;
+			at = skipWhiteSpace(at + 1, end);
+			if (at >= end) return nullptr;
+
+			double value;
+			at = parseNumber(at, end, &value);
+			if (at == nullptr) return nullptr;
+
+			memcpy((char*)record + field.offset, &value, sizeof(value));
+
+			at = skipWhiteSpace(at, end);
+			if (at >= end) return nullptr;
+
+			char expected = i + 1 < field_count ? ',' : '}';
+			if (at[0] != expected) return nullptr;
+			at++;
+		}
+
+		return at;
+	}
+
+	static const char* parseRecordGeneric(const char* at, const char* end, T* record) {
+
+		ceJSON* json = (ceJSON*)ceJSONAllocNode();
+		if (json == nullptr) return nullptr;
+
+		size_t consumed = ceJSONParseValue(at, end - at, json);
+		bool valid = consumed != 0 && json->kind == ceJSONKind::object;
+
+		for (size_t i = 0; valid && i < field_count; i++) {
+			const ceJSONField& field = Fields[i];
+
+			ceJSON* node = ceJSONGetByKey(json, field.name);
+			if (node == nullptr || node->kind != ceJSONKind::number) {
+				valid = false;
+				break;
+			}
+
+			memcpy((char*)record + field.offset, &node->number, sizeof(double));
+		}
+
+		ceJSONFree(json);
+
+		return valid ? at + consumed : nullptr;
+	}
+
+	/* `growable` is false for arrays the caller owns, those are never reallocated */
+	static bool growRecords(T** records, size_t* capacity, size_t required, bool growable) {
+
+		if (required <= *capacity) return true;
+		if (!growable) return false;
+
+		size_t new_capacity = *capacity ? *capacity : 1024;
+		while (new_capacity < required) new_capacity *= 2;
+
+		T* grown = (T*)realloc(*records, new_capacity * sizeof(T));
+		if (grown == nullptr) return false;
+
+		*records = grown;
+		*capacity = new_capacity;
+
+		return true;
+	}
+
+	// Parses `{"<array_key>": [ records... ]}` into a malloc'ed array. Documents with any other top
+	// level layout go through ceJSONParse as a whole.
+	static bool parseArray(const char* buffer, size_t len, const char* array_key, T** records, size_t* count, ceJSONSchemaStats* stats) {
+
+		T* result = nullptr;
+		size_t capacity = 0;
+		if (!parseArrayInto(buffer, len, array_key, &result, &capacity, count, stats)) {
+			free(result);
+			return false;
+		}
+
+		*records = result;
+
+		return true;
+	}
+
+	// Same as parseArray but decodes into `*records`, a malloc'ed array of `*capacity` records
+	// (may be null/0) which is grown when needed. Lets callers reuse one array across documents,
+	// on failure it is left allocated for the caller to reuse or free.
+	static bool parseArrayInto(const char* buffer, size_t len, const char* array_key, T** records, size_t* capacity, size_t* count,
+							   ceJSONSchemaStats* stats) {
+		return parseArrayImpl(buffer, len, array_key, records, capacity, count, stats, true);
+	}
+
+	// Decodes into `records`, an array of `capacity` records from any allocator. It is never grown,
+	// documents with more records than fit fail.
+	static bool parseArrayFixed(const char* buffer, size_t len, const char* array_key, T* records, size_t capacity, size_t* count,
+								ceJSONSchemaStats* stats) {
+		return parseArrayImpl(buffer, len, array_key, &records, &capacity, count, stats, false);
+	}
+
+	static bool parseArrayImpl(const char* buffer, size_t len, const char* array_key, T** records, size_t* capacity, size_t* count,
+							   ceJSONSchemaStats* stats, bool growable) {
+
+		memset(stats, 0, sizeof(*stats));
+		*count = 0;
+
+		const char* at = buffer;
+		const char* end = buffer + len;
+		size_t key_len = strlen(array_key);
+
+		at = skipWhiteSpace(at, end);
+		bool layout_matches = at < end && at[0] == '{';
+		if (layout_matches) {
+			at = skipWhiteSpace(at + 1, end);
+			layout_matches = (size_t)(end - at) > key_len + 1 && at[0] == '"' && memcmp(at + 1, array_key, key_len) == 0 && at[key_len + 1] == '"';
+		}
+		if (layout_matches) {
+			at = skipWhiteSpace(at + key_len + 2, end);
+			layout_matches = at < end && at[0] == ':';
+		}
+		if (layout_matches) {
+			at = skipWhiteSpace(at + 1, end);
+			layout_matches = at < end && at[0] == '[';
+		}
+
+		if (!layout_matches) {
+			return parseArrayGeneric(buffer, len, array_key, records, capacity, count, stats, growable);
+		}
+		at++;
+
+		size_t result_count = 0;
+
+		at = skipWhiteSpace(at, end);
+		if (at < end && at[0] == ']') {
+			at++;
+		}
+		else {
+			for (;;) {
+				if (!growRecords(records, capacity, result_count + 1, growable)) return false;
+
+				T* record = &(*records)[result_count];
+				const char* next = parseRecordFast(at, end, record);
+				if (next != nullptr) {
+					stats->fast_count++;
+				}
+				else {
+					next = parseRecordGeneric(skipWhiteSpace(at, end), end, record);
+					if (next == nullptr) return false;
+					stats->generic_count++;
+				}
+
+				result_count++;
+
+				at = skipWhiteSpace(next, end);
+				if (at >= end) return false;
+
+				if (at[0] == ']') {
+					at++;
+					break;
+				}
+
+				if (at[0] != ',') return false;
+				at++;
+			}
+		}
+
+		at = skipWhiteSpace(at, end);
+		if (at >= end || at[0] != '}') {
+			// Other keys after the array, let the generic path deal with the whole document
+			return parseArrayGeneric(buffer, len, array_key, records, capacity, count, stats, growable);
+		}
+
+		// Same as ceJSONParse, nothing but whitespace may follow the document
+		if (skipWhiteSpace(at + 1, end) != end) return false;
+
+		*count = result_count;
+
+		return true;
+	}
+
+	static bool parseArrayGeneric(const char* buffer, size_t len, const char* array_key, T** records, size_t* capacity, size_t* count,
+								  ceJSONSchemaStats* stats, bool growable) {
+
+		memset(stats, 0, sizeof(*stats));
+
+		ceJSON* root = ceJSONParse(buffer, len);
+		if (root == nullptr) return false;
+
+		ceJSON* array = ceJSONGetByKey(root, array_key);
+		if (array == nullptr || array->kind != ceJSONKind::array || !growRecords(records, capacity, ceJSONLen(array), growable)) {
+			ceJSONFree(root);
+			return false;
+		}
+
+		T* dst = *records;
+		for (ceJSONIterator it = ceJSONIterBegin(array); ceJSONIterValid(&it); ceJSONIterNext(&it)) {
+			for (size_t i = 0; i < field_count; i++) {
+				const ceJSONField& field = Fields[i];
+
+				ceJSON* node = ceJSONGetByKey(it.node, field.name);
+				if (node == nullptr || node->kind != ceJSONKind::number) {
+					ceJSONFree(root);
+					return false;
+				}
+
+				memcpy((char*)dst + field.offset, &node->number, sizeof(double));
+			}
+
+			dst++;
+			stats->generic_count++;
+		}
+
+		ceJSONFree(root);
+
+		*count = dst - *records;
+
+		return true;
+	}
+};
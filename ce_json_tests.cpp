@@ -0,0 +1,902 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+// Correctness gate for the ce_json parsers. Every document is run through the tree parser, the
+// stream parser (fed in random pieces), ceJSONParseValue and, for pair arrays, the schema parser.
+// They have to agree on whether the document is valid and produce the same values down to the bit.
+//
+//   ce_json_tests cases                          hand written edge cases
+//   ce_json_tests fuzz <iterations> <seed>       random (mostly broken) documents
+//   ce_json_tests schema <iterations> <seed>     random pair arrays against the schema parser
+//   ce_json_tests bench <pairs> <min_speedup>    throughput of every parser on a generated pair
+//                                                array, fails if the schema parser is not at least
+//                                                min_speedup times faster than the tree parser
+//
+// Built with CE_JSON_LIBFUZZER the same checks run as a libFuzzer target instead.
+
+#include "ce_json.h"
+#include "ce_json_schema.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct Rng {
+	uint64_t state;
+};
+
+static uint64_t rngNext(Rng* rng) {
+	/* xorshift64* */
+	rng->state ^= rng->state >> 12;
+	rng->state ^= rng->state << 25;
+	rng->state ^= rng->state >> 27;
+	return rng->state * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t rngBelow(Rng* rng, size_t n) {
+	return (size_t)(rngNext(rng) % n);
+}
+
+static bool rngChance(Rng* rng, int percent) {
+	return (int)rngBelow(rng, 100) < percent;
+}
+
+/* Exactly sized copy so reads past the end are caught by sanitizers */
+static char* copyDocument(const std::string& doc) {
+	char* copy = (char*)malloc(doc.size() ? doc.size() : 1);
+	memcpy(copy, doc.data(), doc.size());
+	return copy;
+}
+
+static void printDocument(const char* doc, size_t len) {
+	fprintf(stderr, "document (%llu bytes): \"", (unsigned long long)len);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)doc[i];
+		if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') fputc(c, stderr);
+		else fprintf(stderr, "\\x%02X", c);
+	}
+	fprintf(stderr, "\"\n");
+}
+
+//
+// Canonical form, both the tree and the event stream are written out like this and compared
+//
+
+static void appendNumber(std::string* out, double number) {
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%a", number);
+	*out += buffer;
+}
+
+static void canonicalTree(ceJSON* json, std::string* out) {
+
+	switch (json->kind) {
+
+	case ceJSONKind::null: *out += "null"; break;
+	case ceJSONKind::boolean: *out += json->boolean ? "true" : "false"; break;
+	case ceJSONKind::number: appendNumber(out, json->number); break;
+
+	case ceJSONKind::string:
+		*out += '"';
+		*out += json->string;
+		*out += '"';
+		break;
+
+	case ceJSONKind::object:
+	case ceJSONKind::array: {
+		bool object = json->kind == ceJSONKind::object;
+		*out += object ? '{' : '[';
+
+		for (ceJSON* node = json->first_child; node; node = node->next) {
+			if (node != json->first_child) *out += ',';
+
+			if (object) {
+				*out += '"';
+				*out += node->key;
+				*out += "\":";
+			}
+
+			canonicalTree(node, out);
+		}
+
+		*out += object ? '}' : ']';
+		break;
+	}
+	}
+}
+
+struct CanonicalStream {
+	std::string out;
+	std::vector<bool> object_stack;
+	std::vector<bool> first_stack;
+};
+
+static void canonicalEvent(CanonicalStream* c, const ceJSONEvent& event) {
+
+	if (event.kind == ceJSONEventKind::object_end || event.kind == ceJSONEventKind::array_end) {
+		c->out += event.kind == ceJSONEventKind::object_end ? '}' : ']';
+		c->object_stack.pop_back();
+		c->first_stack.pop_back();
+		return;
+	}
+
+	if (!c->object_stack.empty()) {
+		if (!c->first_stack.back()) c->out += ',';
+		c->first_stack.back() = false;
+
+		if (c->object_stack.back()) {
+			c->out += '"';
+			c->out += event.key;
+			c->out += "\":";
+		}
+	}
+
+	switch (event.kind) {
+	case ceJSONEventKind::object_begin:
+	case ceJSONEventKind::array_begin:
+		c->out += event.kind == ceJSONEventKind::object_begin ? '{' : '[';
+		c->object_stack.push_back(event.kind == ceJSONEventKind::object_begin);
+		c->first_stack.push_back(true);
+		break;
+
+	case ceJSONEventKind::null: c->out += "null"; break;
+	case ceJSONEventKind::boolean: c->out += event.boolean ? "true" : "false"; break;
+	case ceJSONEventKind::number: appendNumber(&c->out, event.number); break;
+
+	case ceJSONEventKind::string:
+		c->out += '"';
+		c->out += event.string;
+		c->out += '"';
+		break;
+
+	default:
+		break;
+	}
+}
+
+//
+// Running the parsers
+//
+
+static bool runTree(const char* doc, size_t len, std::string* canonical) {
+
+	ceJSON* root = ceJSONParse(doc, len);
+	if (root == nullptr) return false;
+
+	canonicalTree(root, canonical);
+	ceJSONFree(root);
+
+	return true;
+}
+
+/* The window is large enough for any token, the pieces fed into it are random */
+static bool runStream(const char* doc, size_t len, Rng* rng, size_t max_piece, std::string* canonical) {
+
+	ceJSONStream s;
+	if (!ceJSONStreamInit(&s, len + 1)) return false;
+
+	CanonicalStream c;
+	size_t fed = 0;
+	bool valid = false;
+
+	for (;;) {
+		ceJSONEvent event;
+		ceJSONStreamResult result = ceJSONStreamNext(&s, &event);
+
+		if (result == ceJSONStreamResult::event) {
+			canonicalEvent(&c, event);
+		}
+		else if (result == ceJSONStreamResult::need_more) {
+			if (fed < len) {
+				size_t piece = 1 + rngBelow(rng, max_piece);
+				if (piece > len - fed) piece = len - fed;
+				fed += ceJSONStreamFeed(&s, doc + fed, piece);
+			}
+
+			if (fed == len) ceJSONStreamEnd(&s);
+		}
+		else {
+			valid = result == ceJSONStreamResult::done;
+			break;
+		}
+	}
+
+	ceJSONStreamFree(&s);
+
+	if (valid) *canonical = c.out;
+
+	return valid;
+}
+
+static bool isTrailingSpace(char c) {
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+/* Returns false on a mismatch between the parsers, which is reported */
+static bool checkDocument(const char* doc, size_t len, Rng* rng) {
+
+	std::string tree;
+	bool tree_valid = runTree(doc, len, &tree);
+
+	// One piece and random small pieces
+	for (size_t max_piece : { len + 1, (size_t)1, (size_t)7 }) {
+		std::string stream;
+		bool stream_valid = runStream(doc, len, rng, max_piece, &stream);
+
+		if (stream_valid != tree_valid || stream != tree) {
+			fprintf(stderr, "tree and stream parser disagree (pieces of up to %llu bytes)\n", (unsigned long long)max_piece);
+			fprintf(stderr, "  tree:   %s %s\n", tree_valid ? "valid" : "invalid", tree.c_str());
+			fprintf(stderr, "  stream: %s %s\n", stream_valid ? "valid" : "invalid", stream.c_str());
+			printDocument(doc, len);
+			return false;
+		}
+	}
+
+	if (tree_valid) {
+		size_t value_end = len;
+		while (value_end > 0 && isTrailingSpace(doc[value_end - 1])) value_end--;
+
+		ceJSON* json = (ceJSON*)ceJSONAllocNode();
+		size_t consumed = ceJSONParseValue(doc, len, json);
+
+		std::string value;
+		if (consumed != 0) canonicalTree(json, &value);
+		ceJSONFree(json);
+
+		if (consumed != value_end || value != tree) {
+			fprintf(stderr, "ceJSONParseValue consumed %llu of %llu bytes\n", (unsigned long long)consumed, (unsigned long long)value_end);
+			fprintf(stderr, "  tree:  %s\n", tree.c_str());
+			fprintf(stderr, "  value: %s\n", value.c_str());
+			printDocument(doc, len);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// Random documents
+//
+
+static void genWhiteSpace(Rng* rng, std::string* out) {
+	static const char* spaces[] = { "", "", "", " ", "\n", "\t", "\r\n  ", "  " };
+	*out += spaces[rngBelow(rng, std::size(spaces))];
+}
+
+static void genString(Rng* rng, std::string* out) {
+	static const char* pieces[] = { "a", "Z", "x0", "y1", " ", "\\\"", "\\\\", "\\n", "\\/", "\\u00e9", "\xC3\xA9", "{", "]", ",", ":" };
+
+	*out += '"';
+	size_t count = rngBelow(rng, 5);
+	for (size_t i = 0; i < count; i++) {
+		*out += pieces[rngBelow(rng, std::size(pieces))];
+	}
+	*out += '"';
+}
+
+static void genDigits(Rng* rng, std::string* out, size_t count, bool leading_zero) {
+	for (size_t i = 0; i < count; i++) {
+		char digit = (char)('0' + rngBelow(rng, 10));
+		if (i == 0 && !leading_zero && digit == '0') digit = '1';
+		*out += digit;
+	}
+}
+
+static void genNumber(Rng* rng, std::string* out) {
+	if (rngChance(rng, 30)) *out += '-';
+
+	if (rngChance(rng, 20)) {
+		*out += '0';
+	}
+	else {
+		// Mostly short, sometimes past the 15 digits of the fast path
+		genDigits(rng, out, rngChance(rng, 10) ? 10 + rngBelow(rng, 15) : 1 + rngBelow(rng, 4), false);
+	}
+
+	if (rngChance(rng, 60)) {
+		*out += '.';
+		genDigits(rng, out, rngChance(rng, 10) ? 10 + rngBelow(rng, 15) : 1 + rngBelow(rng, 16), true);
+	}
+
+	if (rngChance(rng, 15)) {
+		*out += rngChance(rng, 50) ? 'e' : 'E';
+		if (rngChance(rng, 50)) *out += rngChance(rng, 50) ? '+' : '-';
+		genDigits(rng, out, 1 + rngBelow(rng, 3), true);
+	}
+}
+
+static void genValue(Rng* rng, std::string* out, int depth) {
+
+	size_t kind = rngBelow(rng, depth < 6 ? 8 : 6);
+	switch (kind) {
+	case 0: *out += "null"; break;
+	case 1: *out += rngChance(rng, 50) ? "true" : "false"; break;
+	case 2:
+	case 3: genNumber(rng, out); break;
+	case 4:
+	case 5: genString(rng, out); break;
+
+	case 6:
+	case 7: {
+		bool object = kind == 6;
+		*out += object ? '{' : '[';
+
+		size_t count = rngBelow(rng, 5);
+		for (size_t i = 0; i < count; i++) {
+			if (i) *out += ',';
+			genWhiteSpace(rng, out);
+
+			if (object) {
+				genString(rng, out);
+				genWhiteSpace(rng, out);
+				*out += ':';
+				genWhiteSpace(rng, out);
+			}
+
+			genValue(rng, out, depth + 1);
+			genWhiteSpace(rng, out);
+		}
+
+		*out += object ? '}' : ']';
+		break;
+	}
+	}
+}
+
+static void mutateDocument(Rng* rng, std::string* doc) {
+	static const char alphabet[] = "{}[]\":,-+.eE0123456789tfnul \\x\n";
+
+	size_t count = 1 + rngBelow(rng, 3);
+	for (size_t i = 0; i < count && !doc->empty(); i++) {
+		size_t at = rngBelow(rng, doc->size());
+		char c = alphabet[rngBelow(rng, sizeof(alphabet) - 1)];
+
+		switch (rngBelow(rng, 5)) {
+		case 0: (*doc)[at] = c; break;
+		case 1: doc->erase(at, 1); break;
+		case 2: doc->insert(doc->begin() + at, c); break;
+		case 3: doc->resize(at); break;
+		case 4: doc->insert(at, doc->substr(at, rngBelow(rng, 8))); break;
+		}
+	}
+}
+
+static int runCases() {
+
+	std::string deep_valid = std::string(ceJSONStreamMaxDepth, '[') + std::string(ceJSONStreamMaxDepth, ']');
+	std::string deep_invalid = "[" + deep_valid + "]";
+
+	struct Case {
+		std::string json;
+		bool valid;
+	};
+
+	const Case cases[] = {
+		{ "{}", true },
+		{ "[]", true },
+		{ "[1]", true },
+		{ "true", true },
+		{ "null", true },
+		{ "-0", true },
+		{ "  \"x\"  ", true },
+		{ "\"a\\\"b\"", true },
+		{ "{\"a\\\"\":\"\\\\\"}", true },
+		{ "[1.5e3,-2E-2,0.25]", true },
+		{ "[ {}, [], \"\", 0 ]", true },
+		{ R"({"Image": {"Width": 800, "Height": 600, "Title": "View from 15th Floor",
+			"Thumbnail": {"Url": "http://www.example.com/image/481989943", "Height": 125, "Width": 100},
+			"Animated" : false, "IDs": [116, 943, 234, 38793]}})", true },
+		{ R"([{"precision": "zip", "Latitude": 37.7668, "Longitude": -122.3959, "Address": "", "City": "SAN FRANCISCO"},
+			{"precision": "zip", "Latitude": 37.371991, "Longitude": -122.026020, "Address": "", "City": "SUNNYVALE"}])", true },
+		{ deep_valid, true },
+
+		{ "", false },
+		{ "   ", false },
+		{ "{} x", false },
+		{ "[1] [2]", false },
+		{ "[1,]", false },
+		{ "{\"a\":1,}", false },
+		{ "[1 2]", false },
+		{ "{\"a\" 1}", false },
+		{ "{1:2}", false },
+		{ "[01]", false },
+		{ "[1.]", false },
+		{ "[.5]", false },
+		{ "[+1]", false },
+		{ "[1e]", false },
+		{ "-", false },
+		{ "tru", false },
+		{ "trUe", false },
+		{ "\"abc", false },
+		{ "\"a\\\"", false },
+		{ "[", false },
+		{ "]", false },
+		{ "{\"a\":1]", false },
+		{ "[1}", false },
+		{ deep_invalid, false },
+	};
+
+	int failures = 0;
+	Rng rng = { 1 };
+
+	for (const Case& c : cases) {
+		char* doc = copyDocument(c.json);
+
+		std::string tree;
+		bool valid = runTree(doc, c.json.size(), &tree);
+		if (valid != c.valid) {
+			fprintf(stderr, "expected the document to be %s\n", c.valid ? "valid" : "invalid");
+			printDocument(doc, c.json.size());
+			failures++;
+		}
+		else if (!checkDocument(doc, c.json.size(), &rng)) {
+			failures++;
+		}
+
+		free(doc);
+	}
+
+	// Values which are easy to get wrong
+	struct NumberCase {
+		const char* json;
+		double value;
+	};
+
+	const NumberCase numbers[] = {
+		{ "0.1", 0.1 },
+		{ "-122.3959", -122.3959 },
+		{ "1e308", 1e308 },
+		{ "123456789012345678", 123456789012345678. },
+		{ "0.30000000000000004", 0.30000000000000004 },
+	};
+
+	for (const NumberCase& c : numbers) {
+		char* doc = copyDocument(c.json);
+		ceJSON* root = ceJSONParse(doc, strlen(c.json));
+		if (root == nullptr || root->kind != ceJSONKind::number || root->number != c.value) {
+			fprintf(stderr, "wrong value for %s\n", c.json);
+			failures++;
+		}
+
+		if (root) ceJSONFree(root);
+		free(doc);
+	}
+
+	// Lookups by key
+	{
+		const std::string& json = cases[11].json;
+		char* doc = copyDocument(json);
+		ceJSON* root = ceJSONParse(doc, json.size());
+		ceJSON* animated = ceJSONGetByKey(ceJSONGetByKey(root, "Image"), "Animated");
+		if (animated == nullptr || animated->kind != ceJSONKind::boolean || animated->boolean) {
+			fprintf(stderr, "Image.Animated not found\n");
+			failures++;
+		}
+
+		if (root) ceJSONFree(root);
+		free(doc);
+	}
+
+	{
+		const std::string& json = cases[12].json;
+		char* doc = copyDocument(json);
+		ceJSON* root = ceJSONParse(doc, json.size());
+		double lat = 0.;
+		for (ceJSON* node = root ? root->first_child : nullptr; node; node = node->next) {
+			ceJSON* lat_json = ceJSONGetByKey(node, "Latitude");
+			if (lat_json && lat_json->kind == ceJSONKind::number) lat += lat_json->number;
+		}
+
+		if (lat != 37.7668 + 37.371991) {
+			fprintf(stderr, "wrong Latitude sum %.17g\n", lat);
+			failures++;
+		}
+
+		if (root) ceJSONFree(root);
+		free(doc);
+	}
+
+	// Strings are raw views
+	{
+		const char* json = "{\"k\\\"ey\": \"va\\nl\"}";
+		char* doc = copyDocument(json);
+		ceJSON* root = ceJSONParse(doc, strlen(json));
+		ceJSON* node = ceJSONGetByKey(root, "k\\\"ey");
+		if (node == nullptr || node->string != "va\\nl") {
+			fprintf(stderr, "escaped key or string not kept raw\n");
+			failures++;
+		}
+
+		if (root) ceJSONFree(root);
+		free(doc);
+	}
+
+	fprintf(stdout, "cases: %llu, failures: %d\n", (unsigned long long)(std::size(cases) + std::size(numbers) + 3), failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int runFuzz(uint64_t iterations, uint64_t seed) {
+
+	Rng rng = { seed * 0x9E3779B97F4A7C15ull + 1 };
+	uint64_t valid_count = 0;
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		std::string json;
+		genWhiteSpace(&rng, &json);
+		genValue(&rng, &json, 0);
+		genWhiteSpace(&rng, &json);
+
+		if (rngChance(&rng, 50)) mutateDocument(&rng, &json);
+
+		char* doc = copyDocument(json);
+		bool ok = checkDocument(doc, json.size(), &rng);
+
+		std::string tree;
+		valid_count += runTree(doc, json.size(), &tree);
+		free(doc);
+
+		if (!ok) {
+			fprintf(stderr, "fuzz iteration %llu (seed %llu)\n", (unsigned long long)i, (unsigned long long)seed);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fprintf(stdout, "documents: %llu, valid: %llu\n", (unsigned long long)iterations, (unsigned long long)valid_count);
+
+	return EXIT_SUCCESS;
+}
+
+//
+// Schema parser against the tree
+//
+
+struct TestPair {
+	double x0, y0;
+	double x1, y1;
+};
+
+static constexpr ceJSONField testPairFields[] = {
+	CE_JSON_FIELD(TestPair, x0),
+	CE_JSON_FIELD(TestPair, y0),
+	CE_JSON_FIELD(TestPair, x1),
+	CE_JSON_FIELD(TestPair, y1),
+};
+
+using TestPairSchema = ceJSONSchema<TestPair, testPairFields>;
+
+/* What the schema parser has to produce, taken from the tree */
+static bool pairsFromTree(const char* doc, size_t len, std::vector<TestPair>* pairs) {
+
+	ceJSON* root = ceJSONParse(doc, len);
+	ceJSON* array = ceJSONGetByKey(root, "pairs");
+
+	bool valid = array != nullptr && array->kind == ceJSONKind::array;
+	for (ceJSON* node = valid ? array->first_child : nullptr; node && valid; node = node->next) {
+		TestPair pair;
+		for (const ceJSONField& field : testPairFields) {
+			ceJSON* value = ceJSONGetByKey(node, field.name);
+			if (value == nullptr || value->kind != ceJSONKind::number) {
+				valid = false;
+				break;
+			}
+
+			memcpy((char*)&pair + field.offset, &value->number, sizeof(double));
+		}
+
+		pairs->push_back(pair);
+	}
+
+	if (root) ceJSONFree(root);
+
+	return valid;
+}
+
+static void genPair(Rng* rng, std::string* out) {
+	static const char* keys[] = { "x0", "y0", "x1", "y1" };
+
+	int order[4] = { 0, 1, 2, 3 };
+	if (rngChance(rng, 20)) {
+		for (int i = 3; i > 0; i--) std::swap(order[i], order[rngBelow(rng, i + 1)]);
+	}
+
+	*out += '{';
+	bool first = true;
+	for (int i = 0; i < 4; i++) {
+		if (rngChance(rng, 2)) continue; /* missing key */
+
+		if (!first) *out += ',';
+		first = false;
+		genWhiteSpace(rng, out);
+
+		*out += '"';
+		*out += keys[order[i]];
+		*out += "\":";
+		genWhiteSpace(rng, out);
+
+		if (rngChance(rng, 2)) genValue(rng, out, 4);
+		else genNumber(rng, out);
+
+		if (rngChance(rng, 5)) {
+			*out += ",\"extra\":";
+			genValue(rng, out, 4);
+		}
+	}
+	*out += '}';
+}
+
+static void genPairDocument(Rng* rng, std::string* out) {
+	genWhiteSpace(rng, out);
+	*out += '{';
+	genWhiteSpace(rng, out);
+
+	if (rngChance(rng, 5)) *out += "\"before\": 1, ";
+
+	*out += "\"pairs\":";
+	genWhiteSpace(rng, out);
+	*out += '[';
+
+	size_t count = rngBelow(rng, 6);
+	for (size_t i = 0; i < count; i++) {
+		if (i) *out += ",\n";
+		genWhiteSpace(rng, out);
+		if (rngChance(rng, 3)) genValue(rng, out, 4); /* not a pair at all */
+		else genPair(rng, out);
+	}
+
+	*out += ']';
+	genWhiteSpace(rng, out);
+
+	if (rngChance(rng, 5)) *out += ", \"after\": [1]";
+
+	*out += '}';
+	genWhiteSpace(rng, out);
+}
+
+static int runSchema(uint64_t iterations, uint64_t seed) {
+
+	Rng rng = { seed * 0x9E3779B97F4A7C15ull + 1 };
+	uint64_t valid_count = 0;
+	uint64_t fast_count = 0;
+	uint64_t generic_count = 0;
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		std::string json;
+		genPairDocument(&rng, &json);
+		if (rngChance(&rng, 30)) mutateDocument(&rng, &json);
+
+		char* doc = copyDocument(json);
+
+		std::vector<TestPair> expected;
+		bool expected_valid = pairsFromTree(doc, json.size(), &expected);
+
+		TestPair* pairs = nullptr;
+		size_t count = 0;
+		ceJSONSchemaStats stats = {};
+		bool valid = TestPairSchema::parseArray(doc, json.size(), "pairs", &pairs, &count, &stats);
+
+		bool same = valid == expected_valid;
+		if (same && valid) {
+			same = count == expected.size() && (count == 0 || memcmp(pairs, expected.data(), count * sizeof(TestPair)) == 0);
+		}
+
+		// A caller owned array which must never be grown, exactly sized so sanitizers catch overruns
+		size_t fixed_capacity = rngBelow(&rng, 7);
+		TestPair* fixed = (TestPair*)malloc((fixed_capacity ? fixed_capacity : 1) * sizeof(TestPair));
+		size_t fixed_count = 0;
+		ceJSONSchemaStats fixed_stats;
+		bool fixed_valid = TestPairSchema::parseArrayFixed(doc, json.size(), "pairs", fixed, fixed_capacity, &fixed_count, &fixed_stats);
+
+		bool fixed_expected_valid = expected_valid && expected.size() <= fixed_capacity;
+		bool fixed_same = fixed_valid == fixed_expected_valid;
+		if (fixed_same && fixed_valid) {
+			fixed_same = fixed_count == expected.size() && (fixed_count == 0 || memcmp(fixed, expected.data(), fixed_count * sizeof(TestPair)) == 0);
+		}
+
+		free(fixed);
+
+		if (!same || !fixed_same) {
+			fprintf(stderr, "schema parser: %s, %llu pairs; fixed capacity %llu: %s, %llu pairs; tree: %s, %llu pairs\n", valid ? "valid" : "invalid",
+					(unsigned long long)count, (unsigned long long)fixed_capacity, fixed_valid ? "valid" : "invalid", (unsigned long long)fixed_count,
+					expected_valid ? "valid" : "invalid", (unsigned long long)expected.size());
+			printDocument(doc, json.size());
+			fprintf(stderr, "schema iteration %llu (seed %llu)\n", (unsigned long long)i, (unsigned long long)seed);
+			free(pairs);
+			free(doc);
+			return EXIT_FAILURE;
+		}
+
+		valid_count += valid;
+		fast_count += stats.fast_count;
+		generic_count += stats.generic_count;
+
+		free(pairs);
+		free(doc);
+	}
+
+	fprintf(stdout, "documents: %llu, valid: %llu, fast records: %llu, generic records: %llu\n", (unsigned long long)iterations,
+			(unsigned long long)valid_count, (unsigned long long)fast_count, (unsigned long long)generic_count);
+
+	return EXIT_SUCCESS;
+}
+
+//
+// Throughput
+//
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Best of a few runs, returns the sum of every number so the parsers can be checked against each other */
+template <typename F>
+static double benchmark(const char* name, size_t len, F parse, double* best_seconds) {
+
+	double sum = 0.;
+	*best_seconds = 1e30;
+	for (int run = 0; run < 3; run++) {
+		auto start = std::chrono::steady_clock::now();
+		sum = parse();
+		double seconds = secondsSince(start);
+		if (seconds < *best_seconds) *best_seconds = seconds;
+	}
+
+	fprintf(stdout, "%-8s %8.2f MB/s\n", name, len / (1024. * 1024.) / *best_seconds);
+
+	return sum;
+}
+
+static int runBench(uint64_t pair_count, double min_speedup) {
+
+	// Same layout as the generator output
+	std::string json = "{\"pairs\":[\n";
+	Rng rng = { 1234 };
+	for (uint64_t i = 0; i < pair_count; i++) {
+		char line[256];
+		snprintf(line, sizeof(line), "{\"x0\": %f, \"y0\": %f, \"x1\": %f, \"y1\": %f}%s", rngBelow(&rng, 3600000) / 10000. - 180.,
+				 rngBelow(&rng, 1800000) / 10000. - 90., rngBelow(&rng, 3600000) / 10000. - 180., rngBelow(&rng, 1800000) / 10000. - 90.,
+				 i + 1 < pair_count ? ",\n" : "\n");
+		json += line;
+	}
+	json += "]}\n";
+
+	char* doc = copyDocument(json);
+	size_t len = json.size();
+
+	double tree_seconds, stream_seconds, schema_seconds;
+
+	double tree_sum = benchmark("tree", len, [&]() {
+		double sum = 0.;
+		ceJSON* root = ceJSONParse(doc, len);
+		ceJSON* array = ceJSONGetByKey(root, "pairs");
+		for (ceJSON* pair = array ? array->first_child : nullptr; pair; pair = pair->next) {
+			for (ceJSON* value = pair->first_child; value; value = value->next) sum += value->number;
+		}
+		if (root) ceJSONFree(root);
+		return sum;
+	}, &tree_seconds);
+
+	double stream_sum = benchmark("stream", len, [&]() {
+		double sum = 0.;
+		ceJSONStream s;
+		ceJSONStreamInit(&s, 64 * 1024);
+
+		size_t fed = 0;
+		for (;;) {
+			ceJSONEvent event;
+			ceJSONStreamResult result = ceJSONStreamNext(&s, &event);
+			if (result == ceJSONStreamResult::event) {
+				if (event.kind == ceJSONEventKind::number) sum += event.number;
+			}
+			else if (result == ceJSONStreamResult::need_more) {
+				fed += ceJSONStreamFeed(&s, doc + fed, len - fed);
+				if (fed == len) ceJSONStreamEnd(&s);
+			}
+			else {
+				if (result == ceJSONStreamResult::error) sum = -1.;
+				break;
+			}
+		}
+
+		ceJSONStreamFree(&s);
+		return sum;
+	}, &stream_seconds);
+
+	double schema_sum = benchmark("schema", len, [&]() {
+		double sum = 0.;
+		TestPair* pairs = nullptr;
+		size_t count = 0;
+		ceJSONSchemaStats stats;
+		if (TestPairSchema::parseArray(doc, len, "pairs", &pairs, &count, &stats)) {
+			for (size_t i = 0; i < count; i++) {
+				sum += pairs[i].x0;
+				sum += pairs[i].y0;
+				sum += pairs[i].x1;
+				sum += pairs[i].y1;
+			}
+		}
+		free(pairs);
+		return sum;
+	}, &schema_seconds);
+
+	free(doc);
+
+	double speedup = tree_seconds / schema_seconds;
+	fprintf(stdout, "pairs: %llu, input: %.2f MB, schema speedup over tree: %.2fx (required %.2fx)\n", (unsigned long long)pair_count,
+			len / (1024. * 1024.), speedup, min_speedup);
+
+	// Same order of additions in every parser, so the sums match exactly
+	if (tree_sum != stream_sum || tree_sum != schema_sum) {
+		fprintf(stderr, "parsers disagree: tree %.17g, stream %.17g, schema %.17g\n", tree_sum, stream_sum, schema_sum);
+		return EXIT_FAILURE;
+	}
+
+	if (speedup < min_speedup) {
+		fprintf(stderr, "schema parser regressed\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#if CE_JSON_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	Rng rng = { size + 1 };
+	if (!checkDocument((const char*)data, size, &rng)) abort();
+	return 0;
+}
+
+#else
+
+static void printUsage() {
+	fprintf(stderr, "Usage: ce_json_tests cases\n");
+	fprintf(stderr, "Usage: ce_json_tests fuzz <iterations> <seed>\n");
+	fprintf(stderr, "Usage: ce_json_tests schema <iterations> <seed>\n");
+	fprintf(stderr, "Usage: ce_json_tests bench <pairs> <min_speedup>\n");
+}
+
+int main(int argc, char** args) {
+
+	if (argc < 2) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(args[1], "cases") == 0) {
+		return runCases();
+	}
+
+	if (argc < 4) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(args[1], "fuzz") == 0) {
+		return runFuzz(strtoull(args[2], nullptr, 10), strtoull(args[3], nullptr, 10));
+	}
+
+	if (strcmp(args[1], "schema") == 0) {
+		return runSchema(strtoull(args[2], nullptr, 10), strtoull(args[3], nullptr, 10));
+	}
+
+	if (strcmp(args[1], "bench") == 0) {
+		return runBench(strtoull(args[2], nullptr, 10), atof(args[3]));
+	}
+
+	printUsage();
+	return EXIT_FAILURE;
+}
+
+#endif
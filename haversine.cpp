@@ -6,94 +6,68 @@ This source code is licensed under the BSD-style license found in the
 LICENSE file in the root directory of this source tree.
 */
 
-#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 
 #include "ce_json.h"
+#include "ce_json_schema.h"
+#include "haversine.h"
+#include "haversine_batch.h"
+#include "haversine_cluster.h"
+#include "haversine_f32.h"
+#include "haversine_ndjson.h"
+#include "haversine_points.h"
+#include "haversine_query.h"
 #include "haversine_reference.h"
+#include "page_alloc.h"
 #include "platform_metrics.h"
 #include "simple_profiler.h"
 
-struct HaversinePair {
-  double x0, y0;
-  double x1, y1;
+enum class KernelKind {
+  reference,
+  cluster,
+  points,
+  f32,
+  mixed,
 };
 
-static void test() {
-  {
-    const char* json = R"(
-      {
-        "Image": {
-            "Width":  800,
-            "Height": 600,
-            "Title":  "View from 15th Floor",
-            "Thumbnail": {
-                "Url":    "http://www.example.com/image/481989943",
-                "Height": 125,
-                "Width":  100
-            },
-            "Animated" : false,
-            "IDs": [116, 943, 234, 38793]
-          }
-      }
-)";
-
-    ceJSON* root = ceJSONParse(json, strlen(json));
-    assert(root);
-
-    ceJSON* image = ceJSONGetByKey(root, "Image");
-    assert(image);
-    if (image) {
-      ceJSON* Animated = ceJSONGetByKey(image, "Animated");
-      assert(Animated);
-    }
-  }
+static const char* kernelKindStrTable[] = {
+    "reference",
+    "cluster",
+    "points",
+    "f32",
+    "mixed",
+};
 
-  {
-    const char* json = R"(
-      [
-        {
-           "precision": "zip",
-           "Latitude":  37.7668,
-           "Longitude": -122.3959,
-           "Address":   "",
-           "City":      "SAN FRANCISCO",
-           "State":     "CA",
-           "Zip":       "94107",
-           "Country":   "US"
-        },
-        {
-           "precision": "zip",
-           "Latitude":  37.371991,
-           "Longitude": -122.026020,
-           "Address":   "",
-           "City":      "SUNNYVALE",
-           "State":     "CA",
-           "Zip":       "94085",
-           "Country":   "US"
-        }
-      ]
+enum class ParserKind {
+  tree,
+  schema,
+  stream,
+  ndjson,
+};
 
-)";
+static const char* parserKindStrTable[] = {
+    "tree",
+    "schema",
+    "stream",
+    "ndjson",
+};
 
-    ceJSON* root = ceJSONParse(json, strlen(json));
-    assert(root);
+static const char* pageModeStrTable[] = {
+    "malloc",
+    "huge",
+    "hugetlb",
+};
 
-    double lat = 0.;
-    for (ceJSON* node = root->first_child; node; node = node->next) {
-      ceJSON* lat_json = ceJSONGetByKey(node, "Latitude");
-      assert(lat_json);
-      assert(lat_json && lat_json->kind == ceJSONKind::number);
-      if (lat_json && lat_json->kind == ceJSONKind::number) {
-        lat += lat_json->number;
-      }
-    }
-  }
-}
+static const char* numaModeStrTable[] = {
+    "none",
+    "interleave",
+    "first_touch",
+};
 
-static bool loadEntireFile(const char* file_name, void** buffer, size_t* buffer_size) {
+/* The buffer is page allocated, `prefault_pool` places its pages on the workers' nodes before it is read into */
+static bool loadEntireFile(const char* file_name, void** buffer, size_t* buffer_size, WorkPool* prefault_pool = nullptr) {
   TIME_FUNCTION();
 
   FILE* f = fopen(file_name, "rb");
@@ -103,15 +77,19 @@ static bool loadEntireFile(const char* file_name, void** buffer, size_t* buffer_
   _stat64(file_name, &stat);
 #else
   struct stat stat;
-  stat(FileName, &stat);
+  ::stat(file_name, &stat);
 #endif
 
   *buffer_size = stat.st_size;
-  *buffer = malloc(stat.st_size);
+  *buffer = pageAlloc(stat.st_size);
   if (*buffer == nullptr) {
     return false;
   }
 
+  if (prefault_pool != nullptr) {
+    pagePrefault(*buffer, stat.st_size, prefault_pool);
+  }
+
   if (fread(*buffer, stat.st_size, 1, f) != 1) {
     return false;
   }
@@ -121,20 +99,60 @@ static bool loadEntireFile(const char* file_name, void** buffer, size_t* buffer_
   return true;
 }
 
+// The tree only lives until the pairs are copied out of it, so its nodes come from an arena which
+// is released in one go afterwards
+static void* nodeArenaAlloc(size_t size, void* user) { return pageArenaAlloc((PageArena*)user, size); }
+
+static void nodeArenaFree(void*, void*) {}
+
+/* Fails unless x0, y0, x1 and y1 are all present and numbers, like the other parsers */
+static bool pairFromJSON(ceJSON* node, HaversinePair* pair) {
+  ceJSON* j_x0 = ceJSONGetByKey(node, "x0");
+  ceJSON* j_y0 = ceJSONGetByKey(node, "y0");
+  ceJSON* j_x1 = ceJSONGetByKey(node, "x1");
+  ceJSON* j_y1 = ceJSONGetByKey(node, "y1");
+
+  bool valid = j_x0 && j_x0->kind == ceJSONKind::number && j_y0 && j_y0->kind == ceJSONKind::number && j_x1 &&
+               j_x1->kind == ceJSONKind::number && j_y1 && j_y1->kind == ceJSONKind::number;
+  if (!valid) {
+    return false;
+  }
+
+  pair->x0 = j_x0->number;
+  pair->y0 = j_y0->number;
+  pair->x1 = j_x1->number;
+  pair->y1 = j_y1->number;
+
+  return true;
+}
+
 static bool parseAndAllocHaversineDistances(char* json, size_t json_len, HaversinePair** pairs, size_t* count) {
   TIME_FUNCTION();
 
-  ceJSON* root = ceJSONParse(json, json_len);
+  PageArena nodes = {};
+  ceJSONAllocator allocator = {nodeArenaAlloc, nodeArenaFree, &nodes};
+  ceJSONSetAllocator(&allocator);
+
+  ceJSON* root;
+  {
+    TIME_BLOCK("ceJSONParse");
+    root = ceJSONParse(json, json_len);
+  }
+
   ceJSON* j_pairs = ceJSONGetByKey(root, "pairs");
 
-  if (!j_pairs) {
+  ceJSONSetAllocator(nullptr);
+
+  if (!j_pairs || j_pairs->kind != ceJSONKind::array) {
+    pageArenaFree(&nodes);
     return false;
   }
 
   *count = ceJSONLen(j_pairs);
 
-  *pairs = (HaversinePair*)malloc((*count) * sizeof(HaversinePair));
+  *pairs = (HaversinePair*)pageAlloc((*count) * sizeof(HaversinePair));
   if (*pairs == nullptr) {
+    pageArenaFree(&nodes);
     return false;
   }
 
@@ -142,27 +160,197 @@ static bool parseAndAllocHaversineDistances(char* json, size_t json_len, Haversi
   {
     HaversinePair* dst = *pairs;
     for (ceJSONIterator it = ceJSONIterBegin(j_pairs); ceJSONIterValid(&it); ceJSONIterNext(&it)) {
-      ceJSON* node = it.node;
+      if (!pairFromJSON(it.node, dst)) {
+        pageFree(*pairs);
+        pageArenaFree(&nodes);
+        return false;
+      }
 
-      ceJSON* j_x0 = ceJSONGetByKey(node, "x0");
-      ceJSON* j_y0 = ceJSONGetByKey(node, "y0");
-      ceJSON* j_x1 = ceJSONGetByKey(node, "x1");
-      ceJSON* j_y1 = ceJSONGetByKey(node, "y1");
+      dst++;
+    }
+  }
 
-      // TODO: We kind of assume these are valid and we can pull a number from
-      // them I guess...
+  pageArenaFree(&nodes);
 
-      dst->x0 = j_x0->number;
-      dst->y0 = j_y0->number;
-      dst->x1 = j_x1->number;
-      dst->y1 = j_y1->number;
-      dst++;
+  return true;
+}
+
+static bool parseAndAllocHaversineDistancesSchema(char* json, size_t json_len, HaversinePair** pairs, size_t* count) {
+  TIME_FUNCTION();
+
+  // Enough for the input even if every pair is written in its shortest form. Only the pages which
+  // are actually written get backed by memory. The array is never grown, documents with more
+  // array elements than that (which can't all be pairs) fail.
+  size_t capacity = json_len / haversinePairMinJSONSize + 1;
+  *pairs = (HaversinePair*)pageAlloc(capacity * sizeof(HaversinePair));
+  if (*pairs == nullptr) {
+    return false;
+  }
+
+  ceJSONSchemaStats stats;
+  if (!HaversinePairSchema::parseArrayFixed(json, json_len, "pairs", *pairs, capacity, count, &stats)) {
+    pageFree(*pairs);
+    return false;
+  }
+
+  if (stats.generic_count) {
+    fprintf(stdout, "Schema fallbacks: %llu of %llu pairs\n", (unsigned long long)stats.generic_count, (unsigned long long)*count);
+  }
+
+  return true;
+}
+
+static bool parseAndAllocHaversinePointTable(char* json, size_t json_len, HaversinePointTable* table) {
+  TIME_FUNCTION();
+
+  PageArena nodes = {};
+  ceJSONAllocator allocator = {nodeArenaAlloc, nodeArenaFree, &nodes};
+  ceJSONSetAllocator(&allocator);
+
+  ceJSON* root;
+  {
+    TIME_BLOCK("ceJSONParse");
+    root = ceJSONParse(json, json_len);
+  }
+
+  ceJSON* j_pairs = ceJSONGetByKey(root, "pairs");
+
+  ceJSONSetAllocator(nullptr);
+
+  if (!j_pairs || j_pairs->kind != ceJSONKind::array) {
+    pageArenaFree(&nodes);
+    return false;
+  }
+
+  // pointTableBegin zeroes the table first, so pointTableFree is safe on every failure after it
+  if (!pointTableBegin(table, ceJSONLen(j_pairs))) {
+    pointTableFree(table);
+    pageArenaFree(&nodes);
+    return false;
+  }
+
+  TIME_BLOCK("dedup points");
+  for (ceJSONIterator it = ceJSONIterBegin(j_pairs); ceJSONIterValid(&it); ceJSONIterNext(&it)) {
+    HaversinePair pair;
+    if (!pairFromJSON(it.node, &pair) || !pointTableAddPair(table, pair.x0, pair.y0, pair.x1, pair.y1)) {
+      pointTableFree(table);
+      pageArenaFree(&nodes);
+      return false;
     }
   }
 
+  pointTableEnd(table);
+  pageArenaFree(&nodes);
+
   return true;
 }
 
+// Sums the pairs while the file is read in chunks, memory use is bounded by the stream window no
+// matter how large the input is. The pair count is only known at the end, so the distances are
+// summed first and scaled afterwards.
+static bool streamSumHaversineDistances(const char* file_name, size_t* input_size, size_t* pair_count, double* result) {
+  TIME_FUNCTION();
+
+  FILE* f = fopen(file_name, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  ceJSONStream stream;
+  if (!ceJSONStreamInit(&stream, 256 * 1024)) {
+    fclose(f);
+    return false;
+  }
+
+  static char chunk[64 * 1024];
+  size_t chunk_len = 0;
+  size_t chunk_at = 0;
+
+  bool in_pairs = false;
+  bool pairs_found = false;  // Like ceJSONGetByKey only the first top level "pairs" counts
+  HaversinePair pair = {};
+  unsigned seen = 0;  // One bit per coordinate of the current pair
+  double sum = 0.;
+  *pair_count = 0;
+  *input_size = 0;
+
+  bool success = false;
+  for (;;) {
+    ceJSONEvent event;
+    ceJSONStreamResult status = ceJSONStreamNext(&stream, &event);
+
+    if (status == ceJSONStreamResult::need_more) {
+      if (chunk_at == chunk_len) {
+        chunk_len = fread(chunk, 1, sizeof(chunk), f);
+        chunk_at = 0;
+        *input_size += chunk_len;
+
+        if (chunk_len == 0) {
+          ceJSONStreamEnd(&stream);
+          continue;
+        }
+      }
+
+      chunk_at += ceJSONStreamFeed(&stream, chunk + chunk_at, chunk_len - chunk_at);
+      continue;
+    }
+
+    if (status != ceJSONStreamResult::event) {
+      success = status == ceJSONStreamResult::done && pairs_found;
+      break;
+    }
+
+    bool is_end = event.kind == ceJSONEventKind::array_end || event.kind == ceJSONEventKind::object_end;
+
+    if (event.depth == 1 && !is_end && event.key == "pairs" && !pairs_found) {
+      // Anything but an array fails, same as the other parsers
+      if (event.kind != ceJSONEventKind::array_begin) break;
+
+      in_pairs = true;
+      pairs_found = true;
+    }
+    else if (event.depth == 1 && event.kind == ceJSONEventKind::array_end) {
+      in_pairs = false;
+    }
+    else if (in_pairs && event.depth == 3) {
+      // Same rules as the other parsers, all four coordinates have to be numbers
+      double* coordinate = nullptr;
+      unsigned bit = 0;
+      if (event.key == "x0") coordinate = &pair.x0, bit = 1;
+      else if (event.key == "y0") coordinate = &pair.y0, bit = 2;
+      else if (event.key == "x1") coordinate = &pair.x1, bit = 4;
+      else if (event.key == "y1") coordinate = &pair.y1, bit = 8;
+
+      if (coordinate != nullptr) {
+        if (event.kind != ceJSONEventKind::number) break;
+
+        *coordinate = event.number;
+        seen |= bit;
+      }
+    }
+    else if (in_pairs && event.depth == 2 && event.kind == ceJSONEventKind::object_begin) {
+      seen = 0;
+    }
+    else if (in_pairs && event.depth == 2 && event.kind == ceJSONEventKind::object_end) {
+      if (seen != 0xF) break;
+
+      sum += referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+      (*pair_count)++;
+    }
+    else if (in_pairs && event.depth == 2) {
+      // Not a pair object
+      break;
+    }
+  }
+
+  ceJSONStreamFree(&stream);
+  fclose(f);
+
+  *result = *pair_count ? sum / (double)*pair_count : 0.;
+
+  return success;
+}
+
 static double sumHaversineDistances(HaversinePair* pairs, size_t pair_count) {
   TIME_FUNCTION();
 
@@ -202,40 +390,337 @@ static void validation(FILE* f, HaversinePair* pairs, size_t pair_count, double
   fprintf(stdout, "Difference: %.16f\n", result - expected);
 }
 
-int main(int argc, char** args) {
-  // test();
+static bool sumHaversineDistancesWithKernel(KernelKind kernel, ParserKind parser, char* json, size_t json_len, HaversinePair** pairs,
+                                            size_t* pair_count, double* result) {
+  if (kernel == KernelKind::points) {
+    HaversinePointTable table;
+    if (!parseAndAllocHaversinePointTable(json, json_len, &table)) {
+      fprintf(stderr, "Unable to parse or allocate haversine point table\n");
+      return false;
+    }
+
+    *pair_count = table.pair_count;
+    *result = sumHaversineDistancesPointTable(&table);
+
+    size_t table_size = table.point_count * sizeof(HaversinePoint) + table.pair_count * sizeof(HaversineIndexPair);
+    fprintf(stdout, "Unique points: %llu\n", (unsigned long long)table.point_count);
+    fprintf(stdout, "Point table size: %llu (%.2f%% of the pair array)\n", (unsigned long long)table_size,
+            100. * table_size / (double)(*pair_count * sizeof(HaversinePair)));
+
+    pointTableFree(&table);
+  }
+  else {
+    bool parsed = parser == ParserKind::schema ? parseAndAllocHaversineDistancesSchema(json, json_len, pairs, pair_count)
+                                               : parseAndAllocHaversineDistances(json, json_len, pairs, pair_count);
+    if (!parsed) {
+      fprintf(stderr, "Unable to parse or allocate haversine pairs\n");
+      return false;
+    }
+
+    if (kernel == KernelKind::cluster) {
+      // Run the reference as well so the speedup on this particular input is visible
+      uint64 reference_start = readCPUTimer();
+      double reference_result = sumHaversineDistances(*pairs, *pair_count);
+      uint64 reference_elapsed = readCPUTimer() - reference_start;
+
+      ClusterSumStats stats;
+      uint64 cluster_start = readCPUTimer();
+      *result = sumHaversineDistancesClustered(*pairs, *pair_count, &stats);
+      uint64 cluster_elapsed = readCPUTimer() - cluster_start;
+
+      fprintf(stdout, "Tight pairs: %llu (%.2f%%)\n", (unsigned long long)stats.tight_count, 100. * stats.tight_count / (double)*pair_count);
+      fprintf(stdout, "Max sampled relative error: %e\n", stats.max_rel_error);
+      fprintf(stdout, "Difference to reference kernel: %.16f\n", *result - reference_result);
+      fprintf(stdout, "Speedup over reference kernel: %.2fx\n", reference_elapsed / (double)cluster_elapsed);
+    }
+    else if (kernel == KernelKind::f32 || kernel == KernelKind::mixed) {
+      HaversinePairF32* pairs_f32 = allocHaversinePairsF32(*pairs, *pair_count);
+      if (pairs_f32 == nullptr) {
+        fprintf(stderr, "Unable to allocate f32 haversine pairs\n");
+        return false;
+      }
 
+      bool f32_math = kernel == KernelKind::f32;
+      *result = f32_math ? sumHaversineDistancesF32(pairs_f32, *pair_count) : sumHaversineDistancesMixed(pairs_f32, *pair_count);
+
+      double reference_result = sumHaversineDistances(*pairs, *pair_count);
+      HaversineErrorReport report = haversineErrorReportF32(*pairs, pairs_f32, *pair_count, f32_math, reference_result, *result);
+
+      fprintf(stdout, "Max relative error: %e\n", report.max_rel_error);
+      fprintf(stdout, "Mean relative error: %e\n", report.mean_rel_error);
+      fprintf(stdout, "Difference to reference kernel: %.16f\n", report.sum_error);
+
+      free(pairs_f32);
+    }
+    else {
+      *result = sumHaversineDistances(*pairs, *pair_count);
+    }
+  }
+
+  return true;
+}
+
+// Loads the data set once (from JSON or a binary dump written by -save) and answers queries until
+// `quit`. The profiler is only used for the load, query latency is reported per query instead.
+static bool serveHaversineDataset(ParserKind parser, const char* input_file_name, const char* save_file_name, const char* socket_path) {
   Profiler profiler;
   profiler.begin();
 
-  if (argc != 2 && argc != 3) {
-    fprintf(stderr, "Usage: haversine [input.json]\n");
-    fprintf(stderr, "Usage: haversine [input.json] [answers.double]\n");
-    return EXIT_FAILURE;
+  HaversineDataset dataset;
+  const char* extension = strrchr(input_file_name, '.');
+  if (extension != nullptr && strcmp(extension, ".bin") == 0) {
+    if (!datasetLoad(&dataset, input_file_name)) {
+      fprintf(stderr, "Unable to load binary data set\n");
+      return false;
+    }
+  }
+  else {
+    if (parser != ParserKind::tree && parser != ParserKind::schema) {
+      fprintf(stderr, "-serve only supports -parser tree|schema\n");
+      return false;
+    }
+
+    char* json;
+    size_t json_len;
+    if (!loadEntireFile(input_file_name, (void**)&json, &json_len)) {
+      fprintf(stderr, "Unable to load json file\n");
+      return false;
+    }
+
+    HaversinePair* pairs;
+    size_t pair_count;
+    bool parsed = parser == ParserKind::schema ? parseAndAllocHaversineDistancesSchema(json, json_len, &pairs, &pair_count)
+                                               : parseAndAllocHaversineDistances(json, json_len, &pairs, &pair_count);
+    if (!parsed || !datasetBuild(pairs, pair_count, &dataset)) {
+      fprintf(stderr, "Unable to parse or build the data set\n");
+      return false;
+    }
+
+    pageFree(pairs);
+    pageFree(json);
+  }
+
+  if (!datasetBuildLengthIndex(&dataset)) {
+    fprintf(stderr, "Unable to build the top-k index\n");
+    return false;
+  }
+
+  if (!datasetBuildSpatialIndex(&dataset)) {
+    fprintf(stderr, "Unable to build the spatial index\n");
+    return false;
+  }
+
+  if (save_file_name != nullptr && !datasetSave(&dataset, save_file_name)) {
+    fprintf(stderr, "Unable to save the data set to %s\n", save_file_name);
   }
 
-  char* json;
-  size_t json_len;
-  if (!loadEntireFile(args[1], (void**)&json, &json_len)) {
-    fprintf(stderr, "Unable to load json file\n");
+  fprintf(stderr, "Pair count: %llu\n", (unsigned long long)dataset.count);
+  profiler.endAndPrint();
+
+  uint64 cpu_freq = cpuTimerGuessFreq(100);
+
+  // Everything before this line is the load profile, clients can skip to it
+  fprintf(stdout, "ready\n");
+  fflush(stdout);
+
+  bool success = true;
+  if (socket_path != nullptr) {
+    success = serveQueriesOnSocket(&dataset, socket_path, cpu_freq);
+  }
+  else {
+    serveQueries(&dataset, stdin, stdout, cpu_freq);
+  }
+
+  datasetFree(&dataset);
+
+  return success;
+}
+
+template <typename T, size_t N>
+static bool kindFromStr(const char* str, const char* (&table)[N], T* kind) {
+  for (size_t i = 0; i < N; i++) {
+    if (strcmp(str, table[i]) == 0) {
+      *kind = (T)i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void printUsage() {
+  fprintf(stderr, "Usage: haversine [options] [input.json]\n");
+  fprintf(stderr, "Usage: haversine [options] [input.json] [answers.double]\n");
+  fprintf(stderr, "Usage: haversine -batch [-threads N] [file or directory]...\n");
+  fprintf(stderr, "Usage: haversine -serve [-save out.bin] [-socket path] [input.json|input.bin]\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -kernel reference|cluster|points|f32|mixed  Summation kernel (default: reference)\n");
+  fprintf(stderr, "  -parser tree|schema|stream|ndjson          Parser for the pair array (default: tree)\n");
+  fprintf(stderr, "  -threads N                                 Worker threads for -parser ndjson and -batch (default: all cores)\n");
+  fprintf(stderr, "  -batch                                     Sum every .json/.ndjson input file on a shared worker pool\n");
+  fprintf(stderr, "  -pages malloc|huge|hugetlb                 Backing of the file buffer, pair array and tree nodes (default: malloc)\n");
+  fprintf(stderr, "  -numa none|interleave|first_touch          Placement of those pages on multi node machines (default: none)\n");
+}
+
+int main(int argc, char** args) {
+  Profiler profiler;
+  profiler.begin();
+
+  KernelKind kernel = KernelKind::reference;
+  ParserKind parser = ParserKind::tree;
+  int thread_count = (int)std::thread::hardware_concurrency();
+  PageMode page_mode = PageMode::malloc;
+  NumaMode numa_mode = NumaMode::none;
+  bool batch = false;
+  bool serve = false;
+  const char* save_file_name = nullptr;
+  const char* socket_path = nullptr;
+  std::vector<const char*> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(args[i], "-kernel") == 0) {
+      if (i + 1 >= argc || !kindFromStr(args[++i], kernelKindStrTable, &kernel)) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(args[i], "-parser") == 0) {
+      if (i + 1 >= argc || !kindFromStr(args[++i], parserKindStrTable, &parser)) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(args[i], "-threads") == 0) {
+      if (i + 1 >= argc || (thread_count = atoi(args[++i])) <= 0) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(args[i], "-pages") == 0) {
+      if (i + 1 >= argc || !kindFromStr(args[++i], pageModeStrTable, &page_mode)) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(args[i], "-numa") == 0) {
+      if (i + 1 >= argc || !kindFromStr(args[++i], numaModeStrTable, &numa_mode)) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(args[i], "-batch") == 0) {
+      batch = true;
+    }
+    else if (strcmp(args[i], "-serve") == 0) {
+      serve = true;
+    }
+    else if (strcmp(args[i], "-save") == 0) {
+      if (i + 1 >= argc) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+
+      save_file_name = args[++i];
+    }
+    else if (strcmp(args[i], "-socket") == 0) {
+      if (i + 1 >= argc) {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+
+      socket_path = args[++i];
+    }
+    else {
+      inputs.push_back(args[i]);
+    }
+  }
+
+  if (inputs.empty() || (!batch && inputs.size() > 2) || (serve && inputs.size() > 1)) {
+    printUsage();
     return EXIT_FAILURE;
   }
 
-  HaversinePair* pairs;
-  size_t pair_count;
-  if (!parseAndAllocHaversineDistances(json, json_len, &pairs, &pair_count)) {
-    fprintf(stderr, "Unable to parse or allocate haversine pairs\n");
+  pageAllocInit(page_mode, numa_mode);
+  MemoryMetrics memory_start = readMemoryMetrics();
+
+  if (serve) {
+    return serveHaversineDataset(parser, inputs[0], save_file_name, socket_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (batch) {
+    WorkPool pool;
+    workPoolInit(&pool, thread_count);
+    bool success = runHaversineBatch(inputs, &pool);
+    workPoolShutdown(&pool);
+
+    profiler.endAndPrint();
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  const char* input_file_name = inputs[0];
+  const char* answers_file_name = inputs.size() > 1 ? inputs[1] : nullptr;
+
+  size_t input_size = 0;
+  size_t pair_count = 0;
+  HaversinePair* pairs = nullptr;
+  double result = 0.;
+
+  if ((parser == ParserKind::stream || parser == ParserKind::ndjson) && kernel != KernelKind::reference) {
+    fprintf(stderr, "-parser %s only supports the reference kernel\n", parserKindStrTable[(int)parser]);
     return EXIT_FAILURE;
   }
 
-  double result = sumHaversineDistances(pairs, pair_count);
+  if (parser == ParserKind::stream) {
+    if (!streamSumHaversineDistances(input_file_name, &input_size, &pair_count, &result)) {
+      fprintf(stderr, "Unable to stream haversine pairs\n");
+      return EXIT_FAILURE;
+    }
+  }
+  else if (parser == ParserKind::ndjson) {
+    // Started before the load so the workers can fault in the pages of the buffer
+    WorkPool pool;
+    workPoolInit(&pool, thread_count);
+
+    char* json;
+    bool summed = loadEntireFile(input_file_name, (void**)&json, &input_size, &pool) &&
+                  sumHaversineDistancesNDJSON(json, input_size, &pool, &pair_count, &result);
+    workPoolShutdown(&pool);
+
+    if (!summed) {
+      fprintf(stderr, "Unable to load or parse ndjson haversine pairs\n");
+      return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "Threads: %d\n", thread_count);
+  }
+  else {
+    char* json;
+    if (!loadEntireFile(input_file_name, (void**)&json, &input_size)) {
+      fprintf(stderr, "Unable to load json file\n");
+      return EXIT_FAILURE;
+    }
+
+    if (!sumHaversineDistancesWithKernel(kernel, parser, json, input_size, &pairs, &pair_count, &result)) {
+      return EXIT_FAILURE;
+    }
+  }
 
-  fprintf(stdout, "Input size: %llu\n", json_len);
+  fprintf(stdout, "Kernel: %s\n", kernelKindStrTable[(int)kernel]);
+  fprintf(stdout, "Parser: %s\n", parserKindStrTable[(int)parser]);
+  fprintf(stdout, "Input size: %llu\n", input_size);
   fprintf(stdout, "Pair count: %llu\n", pair_count);
   fprintf(stdout, "Haversine sum: %.16f\n", result);
 
-  if (argc == 3) {
-    FILE* f = fopen(args[2], "rb");
+  PageAllocStats page_stats = pageAllocStats();
+  fprintf(stdout, "Pages: %s, NUMA: %s (%d nodes)\n", pageModeStrTable[(int)page_mode], numaModeStrTable[(int)numa_mode], numaNodeCount());
+  fprintf(stdout, "Page allocated: %llu bytes, %llu mapped for huge pages, %llu hugetlb fallbacks\n", (unsigned long long)page_stats.bytes,
+          (unsigned long long)page_stats.huge_bytes, (unsigned long long)page_stats.fallbacks);
+  MemoryMetrics memory_end = readMemoryMetrics();
+  fprintf(stdout, "Page faults: %llu\n", (unsigned long long)(memory_end.minor_faults + memory_end.major_faults - memory_start.minor_faults - memory_start.major_faults));
+
+  if (answers_file_name != nullptr) {
+    FILE* f = fopen(answers_file_name, "rb");
     validation(f, pairs, pair_count, result);
     fclose(f);
   }
@@ -243,4 +728,4 @@ int main(int argc, char** args) {
   profiler.endAndPrint();
 
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
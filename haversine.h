@@ -0,0 +1,31 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_H
+#define HAVERSINE_H
+
+#include "ce_json_schema.h"
+
+struct HaversinePair {
+  double x0, y0;
+  double x1, y1;
+};
+
+static constexpr ceJSONField haversinePairFields[] = {
+    CE_JSON_FIELD(HaversinePair, x0),
+    CE_JSON_FIELD(HaversinePair, y0),
+    CE_JSON_FIELD(HaversinePair, x1),
+    CE_JSON_FIELD(HaversinePair, y1),
+};
+
+using HaversinePairSchema = ceJSONSchema<HaversinePair, haversinePairFields>;
+
+// Shortest possible JSON form of a pair, `{"x0":0,"y0":0,"x1":0,"y1":0}`
+static const size_t haversinePairMinJSONSize = 29;
+
+#endif  // !HAVERSINE_H
@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_BATCH_H
+#define HAVERSINE_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "haversine.h"
+#include "haversine_ndjson.h"
+#include "haversine_reference.h"
+#include "platform_metrics.h"
+#include "work_pool.h"
+
+// Processes many pair files in one run. Every file is a task on the shared work pool, NDJSON files
+// split themselves into chunk tasks on top of that. JSON files are parsed by a single worker, so
+// one large JSON file does not spread over the pool. File buffers, together with the chunk and
+// chunk task arrays of their file, come from a shared free list, the decoded pair arrays are kept
+// per worker and the file tasks are allocated up front, so after the first few files nothing is
+// allocated anymore. The profiler is not thread safe, so the phases are timed per file with
+// readCPUTimer and summed up in the aggregate report instead.
+
+struct BatchContext;
+struct BatchFile;
+
+struct BatchChunkTask {
+  BatchContext* context;
+  BatchFile* file;
+  NDJSONBatch* chunk;
+};
+
+// The chunks of an NDJSON file live exactly as long as its buffer, so they are recycled with it
+struct BatchBuffer {
+  char* data;
+  size_t capacity;
+
+  std::vector<NDJSONBatch> chunks;
+  std::vector<BatchChunkTask> chunk_tasks;
+};
+
+struct BatchFile {
+  std::string path;
+  bool ndjson;
+
+  bool failed;
+  size_t input_size;
+  size_t pair_count;
+  double result;
+
+  uint64 load_cycles;
+  std::atomic<uint64> parse_cycles;  // Includes the sum, NDJSON chunks add theirs up concurrently
+
+  // The buffer of NDJSON files only lives until their last chunk is done
+  BatchBuffer buffer;
+  std::atomic<size_t> chunks_left;
+};
+
+struct BatchWorkerArena {
+  HaversinePair* pairs;
+  size_t pairs_capacity;
+};
+
+struct BatchContext {
+  WorkPool* pool;
+  BatchWorkerArena* arenas;  // One per worker
+
+  std::mutex buffers_mutex;
+  std::vector<BatchBuffer> free_buffers;
+};
+
+struct BatchFileTask {
+  BatchContext* context;
+  BatchFile* file;
+};
+
+static BatchBuffer batchAcquireBuffer(BatchContext* context) {
+  std::lock_guard<std::mutex> lock(context->buffers_mutex);
+
+  BatchBuffer buffer = {};
+  if (!context->free_buffers.empty()) {
+    buffer = std::move(context->free_buffers.back());
+    context->free_buffers.pop_back();
+  }
+
+  return buffer;
+}
+
+static void batchReleaseBuffer(BatchContext* context, BatchBuffer* buffer) {
+  std::lock_guard<std::mutex> lock(context->buffers_mutex);
+  context->free_buffers.push_back(std::move(*buffer));
+  *buffer = {};
+}
+
+static bool batchLoadFile(const char* file_name, BatchBuffer* buffer, size_t* size) {
+  std::error_code error;
+  size_t file_size = (size_t)std::filesystem::file_size(file_name, error);
+  if (error) {
+    return false;
+  }
+
+  FILE* f = fopen(file_name, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  bool success = true;
+  if (file_size > buffer->capacity) {
+    char* data = (char*)realloc(buffer->data, file_size);
+    success = data != nullptr;
+    if (success) {
+      buffer->data = data;
+      buffer->capacity = file_size;
+    }
+  }
+
+  success = success && (file_size == 0 || fread(buffer->data, file_size, 1, f) == 1);
+  fclose(f);
+
+  *size = success ? file_size : 0;
+
+  return success;
+}
+
+static void batchChunkTask(void* data, int) {
+  BatchChunkTask* task = (BatchChunkTask*)data;
+
+  uint64 start = readCPUTimer();
+  sumNDJSONBatch(task->chunk);
+  task->file->parse_cycles += readCPUTimer() - start;
+
+  // The last chunk finishes the file, the task itself is released with the buffer
+  BatchFile* file = task->file;
+  if (--file->chunks_left == 0) {
+    file->failed = !combineNDJSONBatches(file->buffer.chunks, &file->pair_count, &file->result);
+    batchReleaseBuffer(task->context, &file->buffer);
+  }
+}
+
+static void batchFileTask(void* data, int worker) {
+  BatchFileTask* task = (BatchFileTask*)data;
+  BatchContext* context = task->context;
+  BatchFile* file = task->file;
+
+  uint64 start = readCPUTimer();
+
+  BatchBuffer buffer = batchAcquireBuffer(context);
+  if (!batchLoadFile(file->path.c_str(), &buffer, &file->input_size)) {
+    file->failed = true;
+    batchReleaseBuffer(context, &buffer);
+    return;
+  }
+
+  uint64 loaded = readCPUTimer();
+  file->load_cycles = loaded - start;
+
+  if (file->ndjson) {
+    file->buffer = std::move(buffer);
+    std::vector<NDJSONBatch>& chunks = file->buffer.chunks;
+    std::vector<BatchChunkTask>& chunk_tasks = file->buffer.chunk_tasks;
+
+    chunks.clear();
+    splitNDJSONBatches(file->buffer.data, file->input_size, &chunks);
+
+    if (chunks.empty()) {
+      batchReleaseBuffer(context, &file->buffer);
+      return;
+    }
+
+    // Filled completely before anything is pushed, the tasks point into the array
+    chunk_tasks.clear();
+    for (NDJSONBatch& chunk : chunks) {
+      chunk_tasks.push_back({context, file, &chunk});
+    }
+
+    // Set before the first chunk is pushed, a thief could finish it right away
+    file->chunks_left = chunks.size();
+    for (BatchChunkTask& chunk_task : chunk_tasks) {
+      workPoolPush(context->pool, {batchChunkTask, &chunk_task}, worker);
+    }
+
+    return;
+  }
+
+  BatchWorkerArena* arena = &context->arenas[worker];
+
+  ceJSONSchemaStats stats;
+  bool parsed = HaversinePairSchema::parseArrayInto(buffer.data, file->input_size, "pairs", &arena->pairs, &arena->pairs_capacity, &file->pair_count,
+                                                    &stats);
+  batchReleaseBuffer(context, &buffer);
+
+  if (!parsed) {
+    file->failed = true;
+    return;
+  }
+
+  double result = 0.;
+  double sum_coef = 1 / (double)file->pair_count;
+  for (size_t i = 0; i < file->pair_count; i++) {
+    HaversinePair pair = arena->pairs[i];
+    result += sum_coef * referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+  }
+
+  file->result = result;
+  file->parse_cycles = readCPUTimer() - loaded;
+}
+
+static bool isPairFile(const std::filesystem::path& path) { return path.extension() == ".json" || path.extension() == ".ndjson"; }
+
+/* Directories are expanded to the .json/.ndjson files directly inside them, sorted by name */
+static bool collectBatchFiles(std::vector<const char*>& inputs, std::vector<std::string>* paths) {
+  for (const char* input : inputs) {
+    std::error_code error;
+    if (std::filesystem::is_directory(input, error)) {
+      std::vector<std::string> dir_paths;
+      for (const auto& entry : std::filesystem::directory_iterator(input, error)) {
+        if (entry.is_regular_file() && isPairFile(entry.path())) {
+          dir_paths.push_back(entry.path().string());
+        }
+      }
+
+      if (error) {
+        fprintf(stderr, "Unable to read directory %s\n", input);
+        return false;
+      }
+
+      std::sort(dir_paths.begin(), dir_paths.end());
+      paths->insert(paths->end(), dir_paths.begin(), dir_paths.end());
+    }
+    else {
+      paths->push_back(input);
+    }
+  }
+
+  return true;
+}
+
+static bool runHaversineBatch(std::vector<const char*>& inputs, WorkPool* pool) {
+  TIME_FUNCTION();
+
+  std::vector<std::string> paths;
+  if (!collectBatchFiles(inputs, &paths)) {
+    return false;
+  }
+
+  // The files are referenced by the tasks and the atomic counter pins them in place
+  BatchFile* files = new BatchFile[paths.size()];
+  std::vector<BatchFileTask> file_tasks(paths.size());
+
+  BatchContext context;
+  context.pool = pool;
+  context.arenas = (BatchWorkerArena*)calloc(pool->worker_count, sizeof(BatchWorkerArena));
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    BatchFile* file = &files[i];
+    file->path = paths[i];
+    file->ndjson = std::filesystem::path(paths[i]).extension() == ".ndjson";
+    file->failed = false;
+    file->input_size = 0;
+    file->pair_count = 0;
+    file->result = 0.;
+    file->load_cycles = 0;
+    file->parse_cycles = 0;
+    file->buffer = {};
+    file->chunks_left = 0;
+
+    file_tasks[i] = {&context, file};
+    workPoolPush(pool, {batchFileTask, &file_tasks[i]});
+  }
+
+  workPoolWait(pool);
+
+  size_t failed_count = 0;
+  size_t total_input_size = 0;
+  size_t total_pair_count = 0;
+  uint64 total_load_cycles = 0;
+  uint64 total_parse_cycles = 0;
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    BatchFile* file = &files[i];
+    if (file->failed) {
+      fprintf(stdout, "%s: failed\n", file->path.c_str());
+      failed_count++;
+      continue;
+    }
+
+    fprintf(stdout, "%s: pairs %llu, haversine sum %.16f\n", file->path.c_str(), (unsigned long long)file->pair_count, file->result);
+
+    total_input_size += file->input_size;
+    total_pair_count += file->pair_count;
+    total_load_cycles += file->load_cycles;
+    total_parse_cycles += file->parse_cycles;
+  }
+
+  fprintf(stdout, "Files: %llu (%llu failed)\n", (unsigned long long)paths.size(), (unsigned long long)failed_count);
+  fprintf(stdout, "Threads: %d\n", pool->worker_count);
+  fprintf(stdout, "Input size: %llu\n", (unsigned long long)total_input_size);
+  fprintf(stdout, "Pair count: %llu\n", (unsigned long long)total_pair_count);
+  fprintf(stdout, "Load cycles (all workers): %llu\n", (unsigned long long)total_load_cycles);
+  fprintf(stdout, "Parse and sum cycles (all workers): %llu\n", (unsigned long long)total_parse_cycles);
+
+  for (BatchBuffer& buffer : context.free_buffers) {
+    free(buffer.data);
+  }
+
+  for (int i = 0; i < pool->worker_count; i++) {
+    free(context.arenas[i].pairs);
+  }
+
+  free(context.arenas);
+  delete[] files;
+
+  return failed_count == 0;
+}
+
+#endif  // !HAVERSINE_BATCH_H
@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_CLUSTER_H
+#define HAVERSINE_CLUSTER_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "haversine.h"
+#include "haversine_reference.h"
+#include "simple_profiler.h"
+
+// Pairs are processed in batches. A batch whose latitudes span at most twice clusterMaxOffsetDegrees
+// uses the middle of that span as its reference latitude, every latitude in it is then within
+// clusterMaxOffsetDegrees of the reference. In such a batch every pair is classified by its own
+// extent, when |d_lat| and |d_lon| are both at most clusterMaxDeltaDegrees the pair is "tight" and
+// all of its trig is done with short polynomials:
+//
+//   sin(d/2)   Taylor series, |d/2| <= 30 degrees
+//   cos(lat)   cos(ref + o) = cos(ref)cos(o) - sin(ref)sin(o), where cos/sin(ref) are computed once
+//              per batch and o is the offset to the reference, |o| <= 30 degrees
+//   asin       the fdlibm rational approximation, sqrt(a) <= sin(45 degrees) for tight pairs
+//
+// Every other pair, and every pair of a batch with a wider latitude span, goes through
+// referenceHaversine unchanged. Inputs with spatial locality (the generator's cluster mode writes
+// the pairs of each cluster one after another) keep most pairs on the fast path. Inputs without it
+// only pay for the min/max pass over the latitudes of every batch.
+//
+// The series are evaluated far enough that the fast path stays within a few ulp of libm.
+static const double clusterMaxDeltaDegrees = 60.;
+static const double clusterMaxOffsetDegrees = 30.;
+
+// Pairs are classified in batches of this size so the tight and the wide ones each run in their
+// own branch free loop while still walking the input front to back.
+static const int clusterBatchSize = 256;
+
+// Every n-th tight pair is recomputed with the reference to bound the error of the fast path.
+static const size_t clusterSampleInterval = 64;
+
+struct ClusterSumStats {
+  size_t tight_count;
+  double max_rel_error;  // Of the sampled tight pairs against referenceHaversine
+};
+
+struct ClusterReference {
+  double lat;  // Degrees
+  double cos_lat;
+  double sin_lat;
+};
+
+/* Taylor series up to x^13, accurate to about an ulp for |x| <= pi/6 */
+static double clusterSin(double x) {
+  double x2 = x * x;
+  return x * (1. + x2 * (-1. / 6. + x2 * (1. / 120. + x2 * (-1. / 5040. + x2 * (1. / 362880. + x2 * (-1. / 39916800. + x2 * (1. / 6227020800.)))))));
+}
+
+/* Taylor series up to x^14, accurate to about an ulp for |x| <= pi/6 */
+static double clusterCos(double x) {
+  double x2 = x * x;
+  return 1. + x2 * (-1. / 2. + x2 * (1. / 24. + x2 * (-1. / 720. + x2 * (1. / 40320. + x2 * (-1. / 3628800. + x2 * (1. / 479001600. +
+                    x2 * (-1. / 87178291200.)))))));
+}
+
+/* asin for 0 <= s <= sin(45 degrees), the rational approximation and range reduction of fdlibm */
+static double clusterAsin(double s) {
+  // Above 0.5, asin(s) = pi/2 - 2 asin(sqrt((1 - s) / 2)). Both sides are computed so there is no branch.
+  bool reduce = s > 0.5;
+  double x = reduce ? sqrt((1. - s) * 0.5) : s;
+
+  double t = x * x;
+  double p = t * (1.66666666666666657415e-01 +
+                  t * (-3.25565818622400915405e-01 +
+                       t * (2.01212532134862925881e-01 + t * (-4.00555345006794114027e-02 + t * (7.91534994289814532176e-04 + t * 3.47933107596021167570e-05)))));
+  double q = 1. + t * (-2.40339491173441421878e+00 + t * (2.02094576023350569471e+00 + t * (-6.88283971605453293030e-01 + t * 7.70381505559019352791e-02)));
+  double r = x + x * (p / q);
+
+  return reduce ? 1.57079632679489661923 - 2. * r : r;
+}
+
+/* Only meaningful within a batch whose latitudes are all close to the reference. Evaluates both
+   conditions, `&&` would branch on data that is random for most inputs. */
+static bool clusterIsTight(HaversinePair pair) {
+  return (fabs(pair.y1 - pair.y0) <= clusterMaxDeltaDegrees) & (fabs(pair.x1 - pair.x0) <= clusterMaxDeltaDegrees);
+}
+
+/* Same formula as referenceHaversine with every trig term replaced, only valid for tight pairs */
+static double clusterFastHaversine(HaversinePair pair, ClusterReference reference, double earth_radius = 6372.8) {
+  double o0 = radiansFromDegrees(pair.y0 - reference.lat);
+  double o1 = radiansFromDegrees(pair.y1 - reference.lat);
+
+  // cos(ref + o) = cos(ref)cos(o) - sin(ref)sin(o)
+  double cos_lat1 = reference.cos_lat * clusterCos(o0) - reference.sin_lat * clusterSin(o0);
+  double cos_lat2 = reference.cos_lat * clusterCos(o1) - reference.sin_lat * clusterSin(o1);
+
+  double sin_h_lat = clusterSin(0.5 * radiansFromDegrees(pair.y1 - pair.y0));
+  double sin_h_lon = clusterSin(0.5 * radiansFromDegrees(pair.x1 - pair.x0));
+
+  double a = square(sin_h_lat) + cos_lat1 * cos_lat2 * square(sin_h_lon);
+
+  return earth_radius * 2. * clusterAsin(sqrt(a));
+}
+
+static double sumHaversineDistancesClustered(HaversinePair* pairs, size_t pair_count, ClusterSumStats* stats) {
+  TIME_FUNCTION();
+
+  memset(stats, 0, sizeof(*stats));
+
+  double result = 0.;
+  double sum_coef = 1 / (double)pair_count;
+
+  uint32_t tight[clusterBatchSize];
+  uint32_t wide[clusterBatchSize];
+
+  for (size_t batch_start = 0; batch_start < pair_count; batch_start += clusterBatchSize) {
+    HaversinePair* batch = pairs + batch_start;
+    size_t batch_count = pair_count - batch_start;
+    if (batch_count > clusterBatchSize) batch_count = clusterBatchSize;
+
+    double min_lat = batch[0].y0;
+    double max_lat = batch[0].y0;
+    for (size_t i = 0; i < batch_count; i++) {
+      min_lat = std::min(min_lat, std::min(batch[i].y0, batch[i].y1));
+      max_lat = std::max(max_lat, std::max(batch[i].y0, batch[i].y1));
+    }
+
+    if (max_lat - min_lat > 2. * clusterMaxOffsetDegrees) {
+      for (size_t i = 0; i < batch_count; i++) {
+        HaversinePair pair = batch[i];
+        result += sum_coef * referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+      }
+
+      continue;
+    }
+
+    ClusterReference reference;
+    reference.lat = 0.5 * (min_lat + max_lat);
+    reference.cos_lat = cos(radiansFromDegrees(reference.lat));
+    reference.sin_lat = sin(radiansFromDegrees(reference.lat));
+
+    // Both lists are written every iteration and only the matching count advances
+    int tight_count = 0;
+    int wide_count = 0;
+    for (uint32_t i = 0; i < batch_count; i++) {
+      bool is_tight = clusterIsTight(batch[i]);
+      tight[tight_count] = i;
+      wide[wide_count] = i;
+      tight_count += is_tight;
+      wide_count += !is_tight;
+    }
+
+    for (int i = 0; i < wide_count; i++) {
+      HaversinePair pair = batch[wide[i]];
+      result += sum_coef * referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+    }
+
+    for (int i = 0; i < tight_count; i++) {
+      double dist = clusterFastHaversine(batch[tight[i]], reference);
+      result += sum_coef * dist;
+    }
+
+    // Sampling is done on the global tight index so it does not depend on the batch size
+    for (size_t i = (clusterSampleInterval - stats->tight_count % clusterSampleInterval) % clusterSampleInterval; i < (size_t)tight_count;
+         i += clusterSampleInterval) {
+      HaversinePair pair = batch[tight[i]];
+      double dist = clusterFastHaversine(pair, reference);
+      double expected = referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+      if (expected > 0.) {
+        double rel_error = fabs(dist - expected) / expected;
+        if (rel_error > stats->max_rel_error) stats->max_rel_error = rel_error;
+      }
+    }
+
+    stats->tight_count += tight_count;
+  }
+
+  return result;
+}
+
+#endif  // !HAVERSINE_CLUSTER_H
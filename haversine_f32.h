@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_F32_H
+#define HAVERSINE_F32_H
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "haversine.h"
+#include "haversine_reference.h"
+#include "simple_profiler.h"
+
+// Single precision storage of the pairs. Half the size of HaversinePair, which is twice the lanes
+// per register and half the memory traffic for workloads where ~1e-5 relative precision is enough.
+struct HaversinePairF32 {
+  float x0, y0;
+  float x1, y1;
+};
+
+struct HaversineErrorReport {
+  double max_rel_error;  // Per pair, against referenceHaversine on the double input
+  double mean_rel_error;
+  double sum_error;  // Of the total sum, against sumHaversineDistances
+};
+
+static float squareF32(float a) { return a * a; }
+static float radiansFromDegreesF32(float degrees) { return 0.01745329251994329577f * degrees; }
+
+static float referenceHaversineF32(float x0, float y0, float x1, float y1, float earth_radius = 6372.8f) {
+  float lat1 = y0;
+  float lat2 = y1;
+  float lon1 = x0;
+  float lon2 = x1;
+
+  float d_lat = radiansFromDegreesF32(lat2 - lat1);
+  float d_lon = radiansFromDegreesF32(lon2 - lon1);
+  lat1 = radiansFromDegreesF32(lat1);
+  lat2 = radiansFromDegreesF32(lat2);
+
+  float a = squareF32(sinf(d_lat / 2.f)) + cosf(lat1) * cosf(lat2) * squareF32(sinf(d_lon / 2.f));
+  float c = 2.f * asinf(sqrtf(a));
+
+  return earth_radius * c;
+}
+
+static HaversinePairF32* allocHaversinePairsF32(HaversinePair* pairs, size_t pair_count) {
+  TIME_FUNCTION();
+
+  HaversinePairF32* result = (HaversinePairF32*)malloc(pair_count * sizeof(HaversinePairF32));
+  if (result == nullptr) {
+    return nullptr;
+  }
+
+  for (size_t i = 0; i < pair_count; i++) {
+    result[i].x0 = (float)pairs[i].x0;
+    result[i].y0 = (float)pairs[i].y0;
+    result[i].x1 = (float)pairs[i].x1;
+    result[i].y1 = (float)pairs[i].y1;
+  }
+
+  return result;
+}
+
+/* Single precision storage and math, the sum is still accumulated in double */
+static double sumHaversineDistancesF32(HaversinePairF32* pairs, size_t pair_count) {
+  TIME_FUNCTION();
+
+  double result = 0.;
+  double sum_coef = 1 / (double)pair_count;
+
+  for (size_t i = 0; i < pair_count; i++) {
+    HaversinePairF32 pair = pairs[i];
+    float dist = referenceHaversineF32(pair.x0, pair.y0, pair.x1, pair.y1);
+    result += sum_coef * dist;
+  }
+
+  return result;
+}
+
+/* Single precision storage, the math and the sum are done in double */
+static double sumHaversineDistancesMixed(HaversinePairF32* pairs, size_t pair_count) {
+  TIME_FUNCTION();
+
+  double result = 0.;
+  double sum_coef = 1 / (double)pair_count;
+
+  for (size_t i = 0; i < pair_count; i++) {
+    HaversinePairF32 pair = pairs[i];
+    double dist = referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+    result += sum_coef * dist;
+  }
+
+  return result;
+}
+
+static HaversineErrorReport haversineErrorReportF32(HaversinePair* pairs, HaversinePairF32* pairs_f32, size_t pair_count, bool f32_math,
+                                                    double reference_sum, double sum) {
+  TIME_FUNCTION();
+
+  HaversineErrorReport report = {};
+  report.sum_error = sum - reference_sum;
+
+  size_t counted = 0;
+  for (size_t i = 0; i < pair_count; i++) {
+    HaversinePair pair = pairs[i];
+    HaversinePairF32 pair_f32 = pairs_f32[i];
+
+    double expected = referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+    double dist = f32_math ? referenceHaversineF32(pair_f32.x0, pair_f32.y0, pair_f32.x1, pair_f32.y1)
+                           : referenceHaversine(pair_f32.x0, pair_f32.y0, pair_f32.x1, pair_f32.y1);
+
+    if (expected > 0.) {
+      double rel_error = fabs(dist - expected) / expected;
+      if (rel_error > report.max_rel_error) report.max_rel_error = rel_error;
+      report.mean_rel_error += rel_error;
+      counted++;
+    }
+  }
+
+  if (counted) {
+    report.mean_rel_error /= (double)counted;
+  }
+
+  return report;
+}
+
+#endif  // !HAVERSINE_F32_H
@@ -11,6 +11,8 @@ LICENSE file in the root directory of this source tree.
 #include <stdint.h>
 #include <limits>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <algorithm>
 #include <assert.h>
 #include <format>
@@ -42,18 +44,47 @@ static double rand_range(Xorshift32State* state, double min, double max) {
 enum class GeneratorKind {
 	uniform,
 	cluster,
+	hub,
 };
 
 static const char* generatorKindStrTable[] = {
 	"uniform",
 	"cluster",
+	"hub",
 };
 
+static GeneratorKind generatorKindFromStr(const char* str) {
+	for (int i = 0; i < (int)(sizeof(generatorKindStrTable) / sizeof(generatorKindStrTable[0])); i++) {
+		if (strcmp(str, generatorKindStrTable[i]) == 0) {
+			return (GeneratorKind)i;
+		}
+	}
+
+	return GeneratorKind::cluster;
+}
+
+enum class OutputFormat {
+	json,
+	ndjson, /* one pair object per line without the surrounding document */
+};
+
+static void writePair(FILE* f, OutputFormat format, double x0, double y0, double x1, double y1, bool last) {
+	fprintf(f, R"({"x0": %f, "y0": %f, "x1": %f, "y1": %f})", x0, y0, x1, y1);
+
+	if (format == OutputFormat::ndjson) {
+		fprintf(f, "\n");
+	}
+	else if (!last) {
+		fprintf(f, ",\n");
+	}
+}
+
 int main(int argc, char** args) {
 
-	GeneratorKind gen = argc > 1 ? (strcmp("uniform", args[1]) == 0 ? GeneratorKind::uniform : GeneratorKind::cluster) : GeneratorKind::uniform;
+	GeneratorKind gen = argc > 1 ? generatorKindFromStr(args[1]) : GeneratorKind::uniform;
 	uint32_t seed = argc > 2 ? atoi(args[2]) : 1234;
 	int num_coordinates = argc > 3 ? atoi(args[3]) : 100;
+	OutputFormat format = argc > 4 && strcmp(args[4], "ndjson") == 0 ? OutputFormat::ndjson : OutputFormat::json;
 
 	Xorshift32State _state = { seed };
 	Xorshift32State* state = &_state;
@@ -61,8 +92,9 @@ int main(int argc, char** args) {
 	fprintf(stdout, "Method: %s\n", generatorKindStrTable[(int)gen]);
 	fprintf(stdout, "Random seed: %d\n", seed);
 	fprintf(stdout, "Pair count: %d\n", num_coordinates);
+	fprintf(stdout, "Format: %s\n", format == OutputFormat::ndjson ? "ndjson" : "json");
 
-	std::string json_file_name = std::format("data_{}_flex.json", num_coordinates);
+	std::string json_file_name = std::format("data_{}_flex.{}", num_coordinates, format == OutputFormat::ndjson ? "ndjson" : "json");
 	FILE* json_file = fopen(json_file_name.c_str(), "w");
 
 	std::string bin_file_name = std::format("data_{}_haveranswer.double", num_coordinates);
@@ -70,8 +102,10 @@ int main(int argc, char** args) {
 
 	fwrite(&num_coordinates, sizeof(num_coordinates), 1, bin_file);
 
-	const char* json_start = R"({"pairs": [ )";
-	fprintf(json_file, json_start);
+	if (format == OutputFormat::json) {
+		const char* json_start = R"({"pairs": [ )";
+		fprintf(json_file, json_start);
+	}
 
 	double result = 0.;
 	double result_coef = 1. / num_coordinates;
@@ -86,13 +120,37 @@ int main(int argc, char** args) {
 			double h = referenceHaversine(x0, y0, x1, y1);
 			result += h*result_coef;
 
-			fprintf(json_file, R"({"x0": %f, "y0": %f, "x1": %f, "y1": %f})", x0, y0, x1, y1);
+			writePair(json_file, format, x0, y0, x1, y1, i == (num_coordinates-1));
 			fwrite(&h, sizeof(h), 1, bin_file);
+		}
+	}
+	else if (gen == GeneratorKind::hub) {
 
-			if (i < (num_coordinates-1)) {
-				fprintf(json_file, ",\n");
-			}
+		// A small set of depots/hubs which are used as the endpoints of every pair
+		int num_hubs = 1024;
+		double* hubs = (double*)malloc(num_hubs * 2 * sizeof(double));
+
+		for (int i = 0; i < num_hubs; i++) {
+			hubs[2*i + 0] = rand_range(state, -180., 180.);
+			hubs[2*i + 1] = rand_range(state, -180., 180.);
 		}
+
+		for (int i = 0; i < num_coordinates; i++) {
+			int a = xorshift32(state) % num_hubs;
+			int b = xorshift32(state) % num_hubs;
+
+			double x0 = hubs[2*a + 0];
+			double y0 = hubs[2*a + 1];
+			double x1 = hubs[2*b + 0];
+			double y1 = hubs[2*b + 1];
+			double h = referenceHaversine(x0, y0, x1, y1);
+			result += h*result_coef;
+
+			writePair(json_file, format, x0, y0, x1, y1, i == (num_coordinates-1));
+			fwrite(&h, sizeof(h), 1, bin_file);
+		}
+
+		free(hubs);
 	}
 	else {
 
@@ -121,21 +179,19 @@ int main(int argc, char** args) {
 				double h = referenceHaversine(x0, y0, x1, y1);
 				result += h*result_coef;
 
-				fprintf(json_file, R"({"x0": %f, "y0": %f, "x1": %f, "y1": %f})", x0, y0, x1, y1);
-				fwrite(&h, sizeof(h), 1, bin_file);
-
 				bool last_cluster = i == (num_clusters-1);
 				bool last_loop = j == (n-1);
-				if (!last_cluster || !last_loop) {
-					fprintf(json_file, ",\n");
-				}
+				writePair(json_file, format, x0, y0, x1, y1, last_cluster && last_loop);
+				fwrite(&h, sizeof(h), 1, bin_file);
 			}
 		}
 
 		assert(coordinates_left == 0);
 	}
 
-	fprintf(json_file, "]\n}");
+	if (format == OutputFormat::json) {
+		fprintf(json_file, "]\n}");
+	}
 	fclose(json_file);
 
 	double expected_result = result;
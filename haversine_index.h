@@ -0,0 +1,346 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_INDEX_H
+#define HAVERSINE_INDEX_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "haversine_reference.h"
+#include "simple_profiler.h"
+
+// Spatial index for region restricted aggregates. The pairs are sorted along a 4D morton curve over
+// (x0, y0, x1, y1), so pairs close to each other in both endpoints end up next to each other, and
+// cut into blocks of a fixed size. Every block keeps the bounding box of its first and of its second
+// endpoints and the sum of its distances:
+//
+// - a block where either box misses the query region is skipped without touching its pairs
+// - a block where both boxes are inside a bounding box query is added from its sum
+// - only the remaining blocks are checked pair by pair
+//
+// The index keeps its own sorted copy of the coordinates so those checks read contiguous memory.
+static const size_t indexBlockSize = 256;
+
+struct IndexBox {
+  double min_x, min_y;
+  double max_x, max_y;
+};
+
+struct IndexBlock {
+  IndexBox box0;
+  IndexBox box1;
+
+  // Same for the endpoints moved into the real coordinate range, see indexCanonicalPoint
+  IndexBox sphere_box0;
+  IndexBox sphere_box1;
+
+  double sum;
+  size_t begin;
+  size_t count;
+};
+
+struct HaversineIndex {
+  size_t count;
+
+  // Sorted along the curve
+  double* x0;
+  double* y0;
+  double* x1;
+  double* y1;
+  double* dist;
+
+  IndexBlock* blocks;
+  size_t block_count;
+};
+
+struct IndexQueryStats {
+  size_t skipped_blocks;
+  size_t whole_blocks;
+  size_t scanned_blocks;
+};
+
+static uint64_t indexQuantize(double degrees) {
+  double t = (degrees + 180.) * (65536. / 360.);
+  if (!(t >= 0.)) return 0;
+  if (t >= 65535.) return 65535;
+  return (uint64_t)t;
+}
+
+/* Spreads the 16 bits of x so there are three zero bits between each of them */
+static uint64_t mortonSpread4(uint64_t x) {
+  x = (x | (x << 24)) & 0x000000FF000000FFull;
+  x = (x | (x << 12)) & 0x000F000F000F000Full;
+  x = (x | (x << 6)) & 0x0303030303030303ull;
+  x = (x | (x << 3)) & 0x1111111111111111ull;
+  return x;
+}
+
+static void indexBoxReset(IndexBox* box) {
+  box->min_x = box->min_y = INFINITY;
+  box->max_x = box->max_y = -INFINITY;
+}
+
+static void indexBoxAdd(IndexBox* box, double x, double y) {
+  box->min_x = fmin(box->min_x, x);
+  box->min_y = fmin(box->min_y, y);
+  box->max_x = fmax(box->max_x, x);
+  box->max_y = fmax(box->max_y, y);
+}
+
+// The haversine formula is (1 - dot(u0, u1)) / 2 of the two unit vectors (cos(lat) cos(lon), cos(lat) sin(lon), sin(lat)),
+// so coordinates outside of [-90, 90] x [-180, 180] (the generator produces latitudes up to +-180) still name a point on
+// the sphere, and the distance to it is the same as to the real coordinates of that point.
+static void indexCanonicalPoint(double x, double y, double* cx, double* cy) {
+  if (!(y >= -90. && y <= 90. && x >= -180. && x <= 180.)) {
+    y = remainder(y, 360.);
+    if (y > 90.) {
+      y = 180. - y;
+      x += 180.;
+    }
+    else if (y < -90.) {
+      y = -180. - y;
+      x += 180.;
+    }
+
+    x = remainder(x, 360.);
+  }
+
+  *cx = x;
+  *cy = y;
+}
+
+static bool indexBoxOverlaps(const IndexBox& a, const IndexBox& b) {
+  return a.min_x <= b.max_x && a.max_x >= b.min_x && a.min_y <= b.max_y && a.max_y >= b.min_y;
+}
+
+static bool indexBoxContains(const IndexBox& outer, const IndexBox& inner) {
+  return inner.min_x >= outer.min_x && inner.max_x <= outer.max_x && inner.min_y >= outer.min_y && inner.max_y <= outer.max_y;
+}
+
+/* The input arrays are copied, they do not have to outlive the index */
+static bool indexBuild(const double* x0, const double* y0, const double* x1, const double* y1, const double* dist, size_t count,
+                       HaversineIndex* index) {
+  TIME_FUNCTION();
+
+  memset(index, 0, sizeof(*index));
+
+  size_t array_count = count ? count : 1;
+
+  struct Entry {
+    uint64_t key;
+    uint32_t idx;
+  };
+
+  Entry* entries = (Entry*)malloc(array_count * sizeof(Entry));
+  double* block = (double*)malloc(5 * array_count * sizeof(double));
+  index->block_count = (count + indexBlockSize - 1) / indexBlockSize;
+  index->blocks = (IndexBlock*)malloc((index->block_count ? index->block_count : 1) * sizeof(IndexBlock));
+
+  if (entries == nullptr || block == nullptr || index->blocks == nullptr) {
+    free(entries);
+    free(block);
+    free(index->blocks);
+    memset(index, 0, sizeof(*index));
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    entries[i].key = mortonSpread4(indexQuantize(x0[i])) | (mortonSpread4(indexQuantize(y0[i])) << 1) | (mortonSpread4(indexQuantize(x1[i])) << 2) |
+                     (mortonSpread4(indexQuantize(y1[i])) << 3);
+    entries[i].idx = (uint32_t)i;
+  }
+
+  std::sort(entries, entries + count, [](const Entry& a, const Entry& b) { return a.key < b.key; });
+
+  index->count = count;
+  index->x0 = block;
+  index->y0 = block + 1 * array_count;
+  index->x1 = block + 2 * array_count;
+  index->y1 = block + 3 * array_count;
+  index->dist = block + 4 * array_count;
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t idx = entries[i].idx;
+    index->x0[i] = x0[idx];
+    index->y0[i] = y0[idx];
+    index->x1[i] = x1[idx];
+    index->y1[i] = y1[idx];
+    index->dist[i] = dist[idx];
+  }
+
+  free(entries);
+
+  for (size_t b = 0; b < index->block_count; b++) {
+    IndexBlock* dst = &index->blocks[b];
+    dst->begin = b * indexBlockSize;
+    dst->count = std::min(indexBlockSize, count - dst->begin);
+    dst->sum = 0.;
+    indexBoxReset(&dst->box0);
+    indexBoxReset(&dst->box1);
+    indexBoxReset(&dst->sphere_box0);
+    indexBoxReset(&dst->sphere_box1);
+
+    for (size_t i = dst->begin; i < dst->begin + dst->count; i++) {
+      indexBoxAdd(&dst->box0, index->x0[i], index->y0[i]);
+      indexBoxAdd(&dst->box1, index->x1[i], index->y1[i]);
+      dst->sum += index->dist[i];
+
+      double x, y;
+      indexCanonicalPoint(index->x0[i], index->y0[i], &x, &y);
+      indexBoxAdd(&dst->sphere_box0, x, y);
+      indexCanonicalPoint(index->x1[i], index->y1[i], &x, &y);
+      indexBoxAdd(&dst->sphere_box1, x, y);
+    }
+  }
+
+  return true;
+}
+
+static void indexFree(HaversineIndex* index) {
+  free(index->x0);
+  free(index->blocks);
+  memset(index, 0, sizeof(*index));
+}
+
+/* Pairs with both endpoints inside the box, same result as queryBoundingBox up to summation order */
+static void indexQueryBoundingBox(HaversineIndex* index, IndexBox box, size_t* count, double* sum, IndexQueryStats* stats) {
+  *count = 0;
+  *sum = 0.;
+  memset(stats, 0, sizeof(*stats));
+
+  for (size_t b = 0; b < index->block_count; b++) {
+    IndexBlock* block = &index->blocks[b];
+
+    if (!indexBoxOverlaps(block->box0, box) || !indexBoxOverlaps(block->box1, box)) {
+      stats->skipped_blocks++;
+      continue;
+    }
+
+    if (indexBoxContains(box, block->box0) && indexBoxContains(box, block->box1)) {
+      *sum += block->sum;
+      *count += block->count;
+      stats->whole_blocks++;
+      continue;
+    }
+
+    stats->scanned_blocks++;
+    for (size_t i = block->begin; i < block->begin + block->count; i++) {
+      if (index->x0[i] >= box.min_x && index->x0[i] <= box.max_x && index->y0[i] >= box.min_y && index->y0[i] <= box.max_y &&
+          index->x1[i] >= box.min_x && index->x1[i] <= box.max_x && index->y1[i] >= box.min_y && index->y1[i] <= box.max_y) {
+        *sum += index->dist[i];
+        (*count)++;
+      }
+    }
+  }
+}
+
+// Anything within `radius` km of a point lies inside the latitude band of half width radius / R and,
+// away from the poles, inside a longitude band of half width asin(sin(radius / R) / cos(lat)). Blocks
+// are tested against that with their canonical boxes.
+struct IndexRadiusBounds {
+  bool bounded;
+  IndexBox boxes[2];  // Two when the longitude band wraps around
+  int box_count;
+};
+
+static IndexRadiusBounds indexRadiusBounds(double x, double y, double radius, double earth_radius = 6372.8) {
+  IndexRadiusBounds bounds = {};
+
+  double angle = radius / earth_radius;
+  if (!(angle < 1.5)) {
+    return bounds;
+  }
+
+  indexCanonicalPoint(x, y, &x, &y);
+
+  // Some slack for the rounding in the distance calculation
+  const double slack = 1e-9;
+  double d_lat = angle * 57.29577951308232087680 + slack;
+
+  bounds.bounded = true;
+  bounds.box_count = 1;
+  bounds.boxes[0] = {-180., fmax(y - d_lat, -90.), 180., fmin(y + d_lat, 90.)};
+
+  // The band contains a pole, every longitude is possible
+  if (y - d_lat <= -90. || y + d_lat >= 90.) {
+    return bounds;
+  }
+
+  double d_lon = asin(fmin(sin(angle) / cos(radiansFromDegrees(y)), 1.)) * 57.29577951308232087680 + slack;
+  if (d_lon >= 180.) {
+    return bounds;
+  }
+
+  bounds.boxes[0].min_x = x - d_lon;
+  bounds.boxes[0].max_x = x + d_lon;
+  if (bounds.boxes[0].min_x < -180.) {
+    bounds.boxes[1] = {bounds.boxes[0].min_x + 360., bounds.boxes[0].min_y, 180., bounds.boxes[0].max_y};
+    bounds.boxes[0].min_x = -180.;
+    bounds.box_count = 2;
+  }
+  else if (bounds.boxes[0].max_x > 180.) {
+    bounds.boxes[1] = {-180., bounds.boxes[0].min_y, bounds.boxes[0].max_x - 360., bounds.boxes[0].max_y};
+    bounds.boxes[0].max_x = 180.;
+    bounds.box_count = 2;
+  }
+
+  return bounds;
+}
+
+static bool indexRadiusBoundsOverlap(const IndexRadiusBounds& bounds, const IndexBox& box) {
+  if (!bounds.bounded) return true;
+
+  for (int i = 0; i < bounds.box_count; i++) {
+    if (indexBoxOverlaps(bounds.boxes[i], box)) return true;
+  }
+
+  return false;
+}
+
+static bool indexRadiusBoundsContain(const IndexRadiusBounds& bounds, double x, double y) {
+  indexCanonicalPoint(x, y, &x, &y);
+  return indexRadiusBoundsOverlap(bounds, {x, y, x, y});
+}
+
+/* Pairs with both endpoints within `radius` km of (x, y), same result as checking every pair */
+static void indexQueryRadius(HaversineIndex* index, double x, double y, double radius, size_t* count, double* sum, IndexQueryStats* stats) {
+  *count = 0;
+  *sum = 0.;
+  memset(stats, 0, sizeof(*stats));
+
+  IndexRadiusBounds bounds = indexRadiusBounds(x, y, radius);
+
+  for (size_t b = 0; b < index->block_count; b++) {
+    IndexBlock* block = &index->blocks[b];
+
+    if (!indexRadiusBoundsOverlap(bounds, block->sphere_box0) || !indexRadiusBoundsOverlap(bounds, block->sphere_box1)) {
+      stats->skipped_blocks++;
+      continue;
+    }
+
+    stats->scanned_blocks++;
+    for (size_t i = block->begin; i < block->begin + block->count; i++) {
+      // Same test per pair first, which saves most of the distance calculations
+      if (!indexRadiusBoundsContain(bounds, index->x0[i], index->y0[i]) || !indexRadiusBoundsContain(bounds, index->x1[i], index->y1[i])) {
+        continue;
+      }
+
+      if (referenceHaversine(x, y, index->x0[i], index->y0[i]) <= radius && referenceHaversine(x, y, index->x1[i], index->y1[i]) <= radius) {
+        *sum += index->dist[i];
+        (*count)++;
+      }
+    }
+  }
+}
+
+#endif  // !HAVERSINE_INDEX_H
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_NDJSON_H
+#define HAVERSINE_NDJSON_H
+
+#include <emmintrin.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "haversine.h"
+#include "haversine_reference.h"
+#include "simple_profiler.h"
+#include "work_pool.h"
+
+// NDJSON input has one pair object per line, so the buffer can be cut at any newline and every
+// piece parsed and summed on its own. The buffer is split into batches of roughly this many bytes
+// which are run as tasks on the worker pool.
+static const size_t ndjsonBatchSize = 1024 * 1024;
+
+struct NDJSONBatch {
+  const char* begin;
+  const char* end;
+
+  double sum;  // Unscaled, the total pair count is only known once every batch is done
+  size_t count;
+  bool failed;
+};
+
+static int countTrailingZeros(uint32_t x) {
+#if _WIN32
+  unsigned long idx;
+  _BitScanForward(&idx, x);
+  return (int)idx;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/* Returns `end` if there is no newline in [at, end) */
+static const char* findNewline(const char* at, const char* end) {
+  __m128i newline = _mm_set1_epi8('\n');
+  while (end - at >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)at);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+    if (mask) {
+      return at + countTrailingZeros((uint32_t)mask);
+    }
+
+    at += 16;
+  }
+
+  while (at < end && at[0] != '\n') at++;
+  return at;
+}
+
+static void sumNDJSONBatch(NDJSONBatch* batch) {
+  const char* at = batch->begin;
+  while (at < batch->end) {
+    const char* line_end = findNewline(at, batch->end);
+    const char* line = HaversinePairSchema::skipWhiteSpace(at, line_end);
+    at = line_end + 1;
+
+    // Empty lines (e.g. the one after the last record) are allowed
+    if (line == line_end) continue;
+
+    HaversinePair pair;
+    const char* next = HaversinePairSchema::parseRecordFast(line, line_end, &pair);
+    if (next == nullptr) {
+      next = HaversinePairSchema::parseRecordGeneric(line, line_end, &pair);
+    }
+
+    if (next == nullptr || HaversinePairSchema::skipWhiteSpace(next, line_end) != line_end) {
+      batch->failed = true;
+      return;
+    }
+
+    batch->sum += referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+    batch->count++;
+  }
+}
+
+static void sumNDJSONBatchTask(void* data, int) { sumNDJSONBatch((NDJSONBatch*)data); }
+
+/* Cuts the buffer at newlines, the batches reference the buffer so it has to outlive them */
+static void splitNDJSONBatches(const char* buffer, size_t len, std::vector<NDJSONBatch>* batches) {
+  const char* end = buffer + len;
+  for (const char* at = buffer; at < end;) {
+    const char* batch_end = (size_t)(end - at) > ndjsonBatchSize ? findNewline(at + ndjsonBatchSize, end) : end;
+    if (batch_end < end) batch_end++;
+
+    NDJSONBatch batch = {};
+    batch.begin = at;
+    batch.end = batch_end;
+    batches->push_back(batch);
+
+    at = batch_end;
+  }
+}
+
+/* Combined in file order so the result does not depend on the thread count */
+static bool combineNDJSONBatches(std::vector<NDJSONBatch>& batches, size_t* pair_count, double* result) {
+  double sum = 0.;
+  *pair_count = 0;
+  for (NDJSONBatch& batch : batches) {
+    if (batch.failed) return false;
+
+    sum += batch.sum;
+    *pair_count += batch.count;
+  }
+
+  *result = *pair_count ? sum / (double)*pair_count : 0.;
+
+  return true;
+}
+
+static bool sumHaversineDistancesNDJSON(const char* buffer, size_t len, WorkPool* pool, size_t* pair_count, double* result) {
+  TIME_FUNCTION();
+
+  std::vector<NDJSONBatch> batches;
+  splitNDJSONBatches(buffer, len, &batches);
+
+  for (NDJSONBatch& batch : batches) {
+    workPoolPush(pool, {sumNDJSONBatchTask, &batch});
+  }
+
+  workPoolWait(pool);
+
+  return combineNDJSONBatches(batches, pair_count, result);
+}
+
+#endif  // !HAVERSINE_NDJSON_H
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_POINTS_H
+#define HAVERSINE_POINTS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "haversine_reference.h"
+#include "simple_profiler.h"
+
+// Deduplicated representation of the input for data sets which reuse the same endpoints a lot.
+// Every unique point is stored once with the trig terms the haversine formula needs, pairs only
+// store two indices into the point table:
+//
+//   sin(d_lat/2) = sin(lat1/2)cos(lat0/2) - cos(lat1/2)sin(lat0/2)
+//   sin(d_lon/2) = sin(lon1/2)cos(lon0/2) - cos(lon1/2)sin(lon0/2)
+//
+// so the kernel is left with the gathers, a few multiplies and the final sqrt/asin.
+struct HaversinePoint {
+  double sin_half_lat, cos_half_lat;
+  double sin_half_lon, cos_half_lon;
+  double cos_lat;
+};
+
+struct HaversineIndexPair {
+  uint32_t p0, p1;
+};
+
+struct HaversinePointTable {
+  HaversinePoint* points;
+  size_t point_count;
+
+  HaversineIndexPair* pairs;
+  size_t pair_count;
+
+  // Open addressing map from the raw coordinates to the point index, only used while loading
+  double* keys;
+  uint32_t* slots;
+  size_t slot_count;
+  size_t point_capacity;
+};
+
+static uint64_t pointTableHash(double x, double y) {
+  uint64_t a, b;
+  memcpy(&a, &x, sizeof(a));
+  memcpy(&b, &y, sizeof(b));
+
+  uint64_t h = a * 0x9E3779B97F4A7C15ull ^ (b + 0x632BE59BD9B4E019ull + (a << 6) + (a >> 2));
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  return h;
+}
+
+static bool pointTableGrow(HaversinePointTable* table) {
+  size_t point_capacity = table->point_capacity ? table->point_capacity * 2 : 1024;
+
+  HaversinePoint* points = (HaversinePoint*)realloc(table->points, point_capacity * sizeof(HaversinePoint));
+  if (points == nullptr) return false;
+  table->points = points;
+
+  double* keys = (double*)realloc(table->keys, point_capacity * 2 * sizeof(double));
+  if (keys == nullptr) return false;
+  table->keys = keys;
+
+  // Keep the load factor of the map at or below 0.5
+  size_t slot_count = point_capacity * 2;
+  uint32_t* slots = (uint32_t*)malloc(slot_count * sizeof(uint32_t));
+  if (slots == nullptr) return false;
+  memset(slots, 0xFF, slot_count * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < table->point_count; i++) {
+    size_t slot = pointTableHash(keys[2 * i], keys[2 * i + 1]) & (slot_count - 1);
+    while (slots[slot] != UINT32_MAX) slot = (slot + 1) & (slot_count - 1);
+    slots[slot] = i;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->slot_count = slot_count;
+  table->point_capacity = point_capacity;
+
+  return true;
+}
+
+/* Returns the index of the point or UINT32_MAX if the table could not grow */
+static uint32_t pointTableInsert(HaversinePointTable* table, double x, double y) {
+  if (table->point_count == table->point_capacity) {
+    if (!pointTableGrow(table)) return UINT32_MAX;
+  }
+
+  size_t slot = pointTableHash(x, y) & (table->slot_count - 1);
+  for (;;) {
+    uint32_t idx = table->slots[slot];
+    if (idx == UINT32_MAX) break;
+    if (memcmp(&table->keys[2 * idx], &x, sizeof(x)) == 0 && memcmp(&table->keys[2 * idx + 1], &y, sizeof(y)) == 0) {
+      return idx;
+    }
+
+    slot = (slot + 1) & (table->slot_count - 1);
+  }
+
+  uint32_t idx = (uint32_t)table->point_count++;
+  table->slots[slot] = idx;
+  table->keys[2 * idx] = x;
+  table->keys[2 * idx + 1] = y;
+
+  double lat = radiansFromDegrees(y);
+  double lon = radiansFromDegrees(x);
+
+  HaversinePoint* point = &table->points[idx];
+  point->sin_half_lat = sin(0.5 * lat);
+  point->cos_half_lat = cos(0.5 * lat);
+  point->sin_half_lon = sin(0.5 * lon);
+  point->cos_half_lon = cos(0.5 * lon);
+  point->cos_lat = cos(lat);
+
+  return idx;
+}
+
+static bool pointTableBegin(HaversinePointTable* table, size_t pair_count) {
+  memset(table, 0, sizeof(*table));
+
+  table->pairs = (HaversineIndexPair*)malloc(pair_count * sizeof(HaversineIndexPair));
+  if (table->pairs == nullptr) return false;
+
+  return pointTableGrow(table);
+}
+
+static bool pointTableAddPair(HaversinePointTable* table, double x0, double y0, double x1, double y1) {
+  uint32_t p0 = pointTableInsert(table, x0, y0);
+  uint32_t p1 = pointTableInsert(table, x1, y1);
+  if (p0 == UINT32_MAX || p1 == UINT32_MAX) return false;
+
+  table->pairs[table->pair_count++] = {p0, p1};
+  return true;
+}
+
+/* Drops the lookup map, after this no more pairs can be added */
+static void pointTableEnd(HaversinePointTable* table) {
+  free(table->keys);
+  free(table->slots);
+  table->keys = nullptr;
+  table->slots = nullptr;
+  table->slot_count = 0;
+}
+
+static void pointTableFree(HaversinePointTable* table) {
+  pointTableEnd(table);
+  free(table->points);
+  free(table->pairs);
+  memset(table, 0, sizeof(*table));
+}
+
+static double sumHaversineDistancesPointTable(HaversinePointTable* table, double earth_radius = 6372.8) {
+  TIME_FUNCTION();
+
+  double result = 0.;
+  double sum_coef = 1 / (double)table->pair_count;
+
+  HaversinePoint* points = table->points;
+  for (size_t i = 0; i < table->pair_count; i++) {
+    HaversinePoint a = points[table->pairs[i].p0];
+    HaversinePoint b = points[table->pairs[i].p1];
+
+    double sin_h_lat = b.sin_half_lat * a.cos_half_lat - b.cos_half_lat * a.sin_half_lat;
+    double sin_h_lon = b.sin_half_lon * a.cos_half_lon - b.cos_half_lon * a.sin_half_lon;
+
+    double h = square(sin_h_lat) + a.cos_lat * b.cos_lat * square(sin_h_lon);
+    double dist = earth_radius * 2. * asin(sqrt(h));
+    result += sum_coef * dist;
+  }
+
+  return result;
+}
+
+#endif  // !HAVERSINE_POINTS_H
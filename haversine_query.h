@@ -0,0 +1,397 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef HAVERSINE_QUERY_H
+#define HAVERSINE_QUERY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+
+#if !_WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "haversine.h"
+#include "haversine_index.h"
+#include "haversine_reference.h"
+#include "platform_metrics.h"
+#include "simple_profiler.h"
+
+// Resident form of a pair data set for answering many queries without parsing the input again.
+// The coordinates are kept as structure of arrays next to the distance of every pair and a prefix
+// sum over them, so an index range is two lookups. It can be written to and read back from a flat
+// binary file which skips the JSON parse on the next start entirely.
+//
+// Queries are read line by line, every answer ends with a `time_us` line:
+//
+//   range <begin> <end>                      sum and mean distance of the pairs [begin, end)
+//   bbox <min_x> <min_y> <max_x> <max_y>     same for the pairs with both endpoints in the box
+//   radius <x> <y> <km>                      same for the pairs with both endpoints within km of (x, y)
+//   topk <k>                                 the k longest pairs as `<index> <distance>`
+//   quit
+
+struct HaversineDataset {
+  size_t count;
+
+  double* x0;
+  double* y0;
+  double* x1;
+  double* y1;
+  double* dist;
+
+  double* prefix;  // count + 1 entries, prefix[i] is the sum of dist[0, i)
+
+  uint32_t* by_length;  // Indices sorted by descending distance
+
+  HaversineIndex spatial;  // Empty until datasetBuildSpatialIndex
+};
+
+static const char datasetMagic[8] = {'H', 'V', 'D', 'S', 0, 0, 0, 1};
+
+static bool datasetAlloc(HaversineDataset* dataset, size_t count) {
+  memset(dataset, 0, sizeof(*dataset));
+  dataset->count = count;
+
+  // One block for all the arrays
+  size_t array_count = count ? count : 1;
+  double* block = (double*)malloc((5 * array_count + count + 1) * sizeof(double));
+  if (block == nullptr) {
+    return false;
+  }
+
+  dataset->x0 = block;
+  dataset->y0 = block + 1 * array_count;
+  dataset->x1 = block + 2 * array_count;
+  dataset->y1 = block + 3 * array_count;
+  dataset->dist = block + 4 * array_count;
+  dataset->prefix = block + 5 * array_count;
+
+  return true;
+}
+
+static void datasetFree(HaversineDataset* dataset) {
+  free(dataset->x0);
+  free(dataset->by_length);
+  indexFree(&dataset->spatial);
+  memset(dataset, 0, sizeof(*dataset));
+}
+
+static void datasetBuildPrefix(HaversineDataset* dataset) {
+  dataset->prefix[0] = 0.;
+  for (size_t i = 0; i < dataset->count; i++) {
+    dataset->prefix[i + 1] = dataset->prefix[i] + dataset->dist[i];
+  }
+}
+
+static bool datasetBuild(HaversinePair* pairs, size_t count, HaversineDataset* dataset) {
+  TIME_FUNCTION();
+
+  if (!datasetAlloc(dataset, count)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    HaversinePair pair = pairs[i];
+    dataset->x0[i] = pair.x0;
+    dataset->y0[i] = pair.y0;
+    dataset->x1[i] = pair.x1;
+    dataset->y1[i] = pair.y1;
+    dataset->dist[i] = referenceHaversine(pair.x0, pair.y0, pair.x1, pair.y1);
+  }
+
+  datasetBuildPrefix(dataset);
+
+  return true;
+}
+
+static bool datasetSave(HaversineDataset* dataset, const char* file_name) {
+  TIME_FUNCTION();
+
+  FILE* f = fopen(file_name, "wb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  uint64_t count = dataset->count;
+  bool success = fwrite(datasetMagic, sizeof(datasetMagic), 1, f) == 1 && fwrite(&count, sizeof(count), 1, f) == 1;
+
+  // x0, y0, x1, y1 and dist are contiguous
+  if (success && count) {
+    success = fwrite(dataset->x0, sizeof(double), 5 * count, f) == 5 * count;
+  }
+
+  fclose(f);
+
+  return success;
+}
+
+static bool datasetLoad(HaversineDataset* dataset, const char* file_name) {
+  TIME_FUNCTION();
+
+  // datasetFree is safe on failure even when nothing was allocated yet
+  memset(dataset, 0, sizeof(*dataset));
+
+  std::error_code error;
+  uint64_t file_size = (uint64_t)std::filesystem::file_size(file_name, error);
+  if (error) {
+    return false;
+  }
+
+  FILE* f = fopen(file_name, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  char magic[sizeof(datasetMagic)];
+  uint64_t count;
+  bool success = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, datasetMagic, sizeof(magic)) == 0 && fread(&count, sizeof(count), 1, f) == 1;
+
+  // The header is followed by exactly 5 arrays of `count` doubles, a corrupt count must not size the allocation
+  uint64_t header_size = sizeof(datasetMagic) + sizeof(count);
+  success = success && (file_size - header_size) % (5 * sizeof(double)) == 0 && count == (file_size - header_size) / (5 * sizeof(double));
+
+  success = success && datasetAlloc(dataset, count);
+  if (success && count) {
+    success = fread(dataset->x0, sizeof(double), 5 * count, f) == 5 * count;
+  }
+
+  fclose(f);
+
+  if (!success) {
+    datasetFree(dataset);
+    return false;
+  }
+
+  datasetBuildPrefix(dataset);
+
+  return true;
+}
+
+static bool datasetInBox(HaversineDataset* dataset, size_t i, double min_x, double min_y, double max_x, double max_y) {
+  return dataset->x0[i] >= min_x && dataset->x0[i] <= max_x && dataset->y0[i] >= min_y && dataset->y0[i] <= max_y && dataset->x1[i] >= min_x &&
+         dataset->x1[i] <= max_x && dataset->y1[i] >= min_y && dataset->y1[i] <= max_y;
+}
+
+static bool datasetBuildSpatialIndex(HaversineDataset* dataset) {
+  return indexBuild(dataset->x0, dataset->y0, dataset->x1, dataset->y1, dataset->dist, dataset->count, &dataset->spatial);
+}
+
+static void queryBoundingBox(HaversineDataset* dataset, double min_x, double min_y, double max_x, double max_y, size_t* count, double* sum) {
+  if (dataset->spatial.blocks != nullptr) {
+    IndexQueryStats stats;
+    indexQueryBoundingBox(&dataset->spatial, {min_x, min_y, max_x, max_y}, count, sum, &stats);
+    return;
+  }
+
+  *count = 0;
+  *sum = 0.;
+
+  for (size_t i = 0; i < dataset->count; i++) {
+    if (datasetInBox(dataset, i, min_x, min_y, max_x, max_y)) {
+      *sum += dataset->dist[i];
+      (*count)++;
+    }
+  }
+}
+
+static void queryRadius(HaversineDataset* dataset, double x, double y, double radius, size_t* count, double* sum) {
+  if (dataset->spatial.blocks != nullptr) {
+    IndexQueryStats stats;
+    indexQueryRadius(&dataset->spatial, x, y, radius, count, sum, &stats);
+    return;
+  }
+
+  *count = 0;
+  *sum = 0.;
+
+  for (size_t i = 0; i < dataset->count; i++) {
+    if (referenceHaversine(x, y, dataset->x0[i], dataset->y0[i]) <= radius && referenceHaversine(x, y, dataset->x1[i], dataset->y1[i]) <= radius) {
+      *sum += dataset->dist[i];
+      (*count)++;
+    }
+  }
+}
+
+static bool datasetBuildLengthIndex(HaversineDataset* dataset) {
+  TIME_FUNCTION();
+
+  uint32_t* by_length = (uint32_t*)malloc((dataset->count ? dataset->count : 1) * sizeof(uint32_t));
+  if (by_length == nullptr) {
+    return false;
+  }
+
+  for (size_t i = 0; i < dataset->count; i++) by_length[i] = (uint32_t)i;
+
+  double* dist = dataset->dist;
+  std::sort(by_length, by_length + dataset->count, [dist](uint32_t a, uint32_t b) { return dist[a] > dist[b]; });
+  dataset->by_length = by_length;
+
+  return true;
+}
+
+static bool queryTopK(HaversineDataset* dataset, FILE* out, size_t k) {
+  if (dataset->by_length == nullptr) {
+    return false;
+  }
+
+  if (k > dataset->count) k = dataset->count;
+  for (size_t i = 0; i < k; i++) {
+    uint32_t idx = dataset->by_length[i];
+    fprintf(out, "%u %.16f\n", idx, dataset->dist[idx]);
+  }
+
+  return true;
+}
+
+/* Answers queries from `in` until `quit`, the end of the input or a failed write (the client went away).
+   Returns false once `quit` was received */
+static bool serveQueries(HaversineDataset* dataset, FILE* in, FILE* out, uint64 cpu_freq) {
+  char line[512];
+  while (fgets(line, sizeof(line), in)) {
+    uint64 start = readCPUTimer();
+
+    char command[16] = {};
+    if (sscanf(line, "%15s", command) != 1) continue;
+
+    if (strcmp(command, "quit") == 0) {
+      return false;
+    }
+
+    if (strcmp(command, "range") == 0) {
+      unsigned long long begin, end;
+      if (sscanf(line, "%*s %llu %llu", &begin, &end) != 2 || begin > end || end > dataset->count) {
+        fprintf(out, "error invalid range\n");
+      }
+      else {
+        double sum = dataset->prefix[end] - dataset->prefix[begin];
+        fprintf(out, "count %llu\nsum %.16f\nmean %.16f\n", end - begin, sum, end > begin ? sum / (double)(end - begin) : 0.);
+      }
+    }
+    else if (strcmp(command, "bbox") == 0) {
+      double min_x, min_y, max_x, max_y;
+      if (sscanf(line, "%*s %lf %lf %lf %lf", &min_x, &min_y, &max_x, &max_y) != 4) {
+        fprintf(out, "error invalid bbox\n");
+      }
+      else {
+        size_t count;
+        double sum;
+        queryBoundingBox(dataset, min_x, min_y, max_x, max_y, &count, &sum);
+        fprintf(out, "count %llu\nsum %.16f\nmean %.16f\n", (unsigned long long)count, sum, count ? sum / (double)count : 0.);
+      }
+    }
+    else if (strcmp(command, "radius") == 0) {
+      double x, y, radius;
+      if (sscanf(line, "%*s %lf %lf %lf", &x, &y, &radius) != 3) {
+        fprintf(out, "error invalid radius\n");
+      }
+      else {
+        size_t count;
+        double sum;
+        queryRadius(dataset, x, y, radius, &count, &sum);
+        fprintf(out, "count %llu\nsum %.16f\nmean %.16f\n", (unsigned long long)count, sum, count ? sum / (double)count : 0.);
+      }
+    }
+    else if (strcmp(command, "topk") == 0) {
+      unsigned long long k;
+      if (sscanf(line, "%*s %llu", &k) != 1 || !queryTopK(dataset, out, k)) {
+        fprintf(out, "error invalid topk\n");
+      }
+    }
+    else {
+      fprintf(out, "error unknown query %s\n", command);
+    }
+
+    fprintf(out, "time_us %.3f\n", (readCPUTimer() - start) * 1e6 / (double)cpu_freq);
+    if (fflush(out) != 0 || ferror(out)) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+/* Serves one client at a time until a client sends `quit` */
+static bool serveQueriesOnSocket(HaversineDataset* dataset, const char* socket_path, uint64 cpu_freq) {
+#if _WIN32
+  fprintf(stderr, "UNIX sockets are not supported on this platform\n");
+  return false;
+#else
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return false;
+  }
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    close(listener);
+    return false;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  // Only replace a socket left behind by an earlier server, never some other file at that path
+  struct stat existing;
+  if (lstat(socket_path, &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      fprintf(stderr, "%s exists and is not a socket\n", socket_path);
+      close(listener);
+      return false;
+    }
+
+    unlink(socket_path);
+  }
+
+  if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+    close(listener);
+    return false;
+  }
+
+  fprintf(stderr, "Listening on %s\n", socket_path);
+
+  // A client closing before it read its answer must not kill the server, the write fails with
+  // EPIPE instead and serveQueries moves on to the next client
+  void (*previous_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+  bool running = true;
+  while (running) {
+    int client = accept(listener, nullptr, nullptr);
+    if (client < 0) break;
+
+    FILE* in = fdopen(client, "r");
+    if (in == nullptr) {
+      close(client);
+      continue;
+    }
+
+    FILE* out = fdopen(dup(client), "w");
+    if (out != nullptr) {
+      running = serveQueries(dataset, in, out, cpu_freq);
+      fclose(out);
+    }
+
+    fclose(in);
+  }
+
+  signal(SIGPIPE, previous_sigpipe);
+
+  close(listener);
+  unlink(socket_path);
+
+  return true;
+#endif
+}
+
+#endif  // !HAVERSINE_QUERY_H
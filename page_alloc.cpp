@@ -0,0 +1,295 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#include "page_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const size_t pageSmallSize = 4096;
+static const size_t pageHugeSize = 2 * 1024 * 1024;
+static const size_t pageArenaChunkSize = 64 * 1024 * 1024;
+
+// In front of every block, padded to a cache line so the blocks stay aligned
+static const size_t pageHeaderSize = 64;
+
+struct PageHeader {
+  void* mapping;
+  size_t mapping_size;
+  bool mapped;  // false for malloc
+};
+
+static PageMode g_page_mode = PageMode::malloc;
+static NumaMode g_numa_mode = NumaMode::none;
+
+static int g_numa_node_count = 0;
+static uint64_t g_numa_node_mask = 0;
+
+static std::atomic<uint64_t> g_page_allocations;
+static std::atomic<uint64_t> g_page_bytes;
+static std::atomic<uint64_t> g_page_huge_bytes;
+static std::atomic<uint64_t> g_page_fallbacks;
+
+static size_t roundUp(size_t size, size_t granularity) { return (size + granularity - 1) / granularity * granularity; }
+
+static void numaDetectNodes() {
+#if _WIN32
+  ULONG highest = 0;
+  if (!GetNumaHighestNodeNumber(&highest)) highest = 0;
+  g_numa_node_count = (int)highest + 1;
+  g_numa_node_mask = highest >= 63 ? ~0ull : (1ull << (highest + 1)) - 1;
+#else
+  // e.g. "0", "0-3" or "0,2-3"
+  g_numa_node_count = 1;
+  g_numa_node_mask = 1;
+
+  FILE* f = fopen("/sys/devices/system/node/online", "r");
+  if (f == nullptr) return;
+
+  char line[256] = {};
+  bool read = fgets(line, sizeof(line), f) != nullptr;
+  fclose(f);
+  if (!read) return;
+
+  int count = 0;
+  uint64_t mask = 0;
+  for (char* at = line; *at && *at != '\n';) {
+    int first = (int)strtol(at, &at, 10);
+    int last = first;
+    if (*at == '-') last = (int)strtol(at + 1, &at, 10);
+    if (*at == ',') at++;
+
+    for (int node = first; node <= last && node < 64; node++) {
+      mask |= 1ull << node;
+      count++;
+    }
+
+    if (first > last) break;
+  }
+
+  if (count) {
+    g_numa_node_count = count;
+    g_numa_node_mask = mask;
+  }
+#endif
+}
+
+void pageAllocInit(PageMode mode, NumaMode numa) {
+  g_page_mode = mode;
+  g_numa_mode = numa;
+  numaDetectNodes();
+}
+
+PageMode pageAllocMode() { return g_page_mode; }
+
+NumaMode pageAllocNuma() { return g_numa_mode; }
+
+PageAllocStats pageAllocStats() {
+  PageAllocStats stats;
+  stats.allocations = g_page_allocations;
+  stats.bytes = g_page_bytes;
+  stats.huge_bytes = g_page_huge_bytes;
+  stats.fallbacks = g_page_fallbacks;
+  return stats;
+}
+
+int numaNodeCount() {
+  if (g_numa_node_count == 0) numaDetectNodes();
+  return g_numa_node_count;
+}
+
+static void pageInterleave(void* ptr, size_t size) {
+#if !_WIN32
+  if (g_numa_mode != NumaMode::interleave || g_numa_node_count < 2) return;
+
+  // MPOL_INTERLEAVE, called directly to not depend on libnuma. Failing only costs the placement.
+  const int mpol_interleave = 3;
+  syscall(SYS_mbind, ptr, size, mpol_interleave, &g_numa_node_mask, (unsigned long)64, 0u);
+#endif
+}
+
+/* Returns nullptr when not even normal pages could be mapped */
+static void* pageMapHuge(size_t size, size_t* mapping_size) {
+#if _WIN32
+  // Large pages need SeLockMemoryPrivilege, without it the allocation fails and normal pages are used
+  SIZE_T large_size = GetLargePageMinimum();
+  if (large_size) {
+    size_t total = roundUp(size, large_size);
+    void* ptr = VirtualAlloc(nullptr, total, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (ptr != nullptr) {
+      *mapping_size = total;
+      g_page_huge_bytes += total;
+      return ptr;
+    }
+  }
+
+  g_page_fallbacks++;
+
+  *mapping_size = roundUp(size, pageSmallSize);
+  return VirtualAlloc(nullptr, *mapping_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  size_t total = roundUp(size, pageHugeSize);
+
+  if (g_page_mode == PageMode::hugetlb) {
+    void* ptr = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      pageInterleave(ptr, total);
+      *mapping_size = total;
+      g_page_huge_bytes += total;
+      return ptr;
+    }
+
+    g_page_fallbacks++;
+  }
+
+  // Transparent huge pages are only used for 2 MB aligned ranges, so map one more page and cut
+  // the aligned part out of it
+  char* raw = (char*)mmap(nullptr, total + pageHugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+
+  char* aligned = (char*)roundUp((uintptr_t)raw, pageHugeSize);
+  if (aligned > raw) munmap(raw, aligned - raw);
+  munmap(aligned + total, raw + total + pageHugeSize - (aligned + total));
+
+  if (madvise(aligned, total, MADV_HUGEPAGE) == 0) {
+    g_page_huge_bytes += total;
+  }
+
+  pageInterleave(aligned, total);
+
+  *mapping_size = total;
+  return aligned;
+#endif
+}
+
+void* pageAlloc(size_t size) {
+  size_t total = size + pageHeaderSize;
+
+  PageHeader header = {};
+  if (g_page_mode == PageMode::malloc) {
+    header.mapping = malloc(total);
+    header.mapping_size = total;
+  }
+  else {
+    header.mapping = pageMapHuge(total, &header.mapping_size);
+    header.mapped = true;
+  }
+
+  if (header.mapping == nullptr) {
+    return nullptr;
+  }
+
+  g_page_allocations++;
+  g_page_bytes += size;
+
+  memcpy(header.mapping, &header, sizeof(header));
+  return (char*)header.mapping + pageHeaderSize;
+}
+
+void pageFree(void* ptr) {
+  if (ptr == nullptr) return;
+
+  PageHeader header;
+  memcpy(&header, (char*)ptr - pageHeaderSize, sizeof(header));
+
+  if (!header.mapped) {
+    free(header.mapping);
+    return;
+  }
+
+#if _WIN32
+  VirtualFree(header.mapping, 0, MEM_RELEASE);
+#else
+  munmap(header.mapping, header.mapping_size);
+#endif
+}
+
+struct PrefaultTask {
+  volatile char* begin;
+  volatile char* end;
+};
+
+static void prefaultTask(void* data, int) {
+  PrefaultTask* task = (PrefaultTask*)data;
+  for (volatile char* at = task->begin; at < task->end; at += pageSmallSize) {
+    *at = 0;
+  }
+}
+
+void pagePrefault(void* ptr, size_t size, WorkPool* pool) {
+  if (g_numa_mode != NumaMode::first_touch) return;
+
+  // Slices start on a page boundary. The page containing `ptr` also holds the block header and was
+  // faulted in by pageAlloc already. Tasks can still be stolen by another worker, the placement is
+  // best effort.
+  char* begin = (char*)roundUp((uintptr_t)ptr, pageSmallSize);
+  char* end = (char*)ptr + size;
+  if (begin >= end) return;
+
+  size_t slice_size = roundUp((end - begin + pool->worker_count - 1) / pool->worker_count, pageSmallSize);
+
+  std::vector<PrefaultTask> tasks;
+  for (char* at = begin; at < end; at += slice_size) {
+    tasks.push_back({at, std::min(at + slice_size, end)});
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    workPoolPush(pool, {prefaultTask, &tasks[i]}, (int)i % pool->worker_count);
+  }
+
+  workPoolWait(pool);
+}
+
+void* pageArenaAlloc(PageArena* arena, size_t size) {
+  size = roundUp(size, 16);
+
+  if (arena->chunk == nullptr || arena->used + size > arena->capacity) {
+    size_t capacity = std::max(pageArenaChunkSize, size + 16);
+    char* chunk = (char*)pageAlloc(capacity);
+    if (chunk == nullptr) {
+      return nullptr;
+    }
+
+    memcpy(chunk, &arena->chunk, sizeof(arena->chunk));
+    arena->chunk = chunk;
+    arena->used = 16;
+    arena->capacity = capacity;
+  }
+
+  void* result = arena->chunk + arena->used;
+  arena->used += size;
+
+  return result;
+}
+
+void pageArenaFree(PageArena* arena) {
+  char* chunk = arena->chunk;
+  while (chunk != nullptr) {
+    char* prev;
+    memcpy(&prev, chunk, sizeof(prev));
+    pageFree(chunk);
+    chunk = prev;
+  }
+
+  memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef PAGE_ALLOC_H
+#define PAGE_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "work_pool.h"
+
+// Allocation layer for the large arrays (file buffers, pair arrays, tree nodes). Depending on the
+// page mode they are backed by:
+//
+//   malloc   plain malloc, same as before
+//   huge     2 MB aligned mappings marked for transparent huge pages (MADV_HUGEPAGE on Linux,
+//            MEM_LARGE_PAGES on Windows when the process is allowed to use them)
+//   hugetlb  explicit huge pages (MAP_HUGETLB), falls back to `huge` when the pool is empty
+//
+// On machines with more than one NUMA node the mappings can be interleaved over all nodes, or
+// prefaulted by the threads of a work pool so every worker's slice lands on its own node. Every
+// block starts with a small header so pageFree only needs the pointer.
+
+enum class PageMode {
+  malloc,
+  huge,
+  hugetlb,
+};
+
+enum class NumaMode {
+  none,
+  interleave,
+  first_touch,
+};
+
+struct PageAllocStats {
+  uint64_t allocations;
+  uint64_t bytes;       // Requested
+  uint64_t huge_bytes;  // Mapped with huge pages requested, rounded up to whole pages
+  uint64_t fallbacks;   // hugetlb allocations which got transparent huge pages instead
+};
+
+// Not synchronized, called once before the first allocation
+void pageAllocInit(PageMode mode, NumaMode numa);
+PageMode pageAllocMode();
+NumaMode pageAllocNuma();
+PageAllocStats pageAllocStats();
+
+int numaNodeCount();
+
+void* pageAlloc(size_t size);
+void pageFree(void* ptr);
+
+// Touches every page of [ptr, ptr + size) from the workers of the pool, one slice per worker, so
+// the memory is placed on the node of the worker which faulted it in. Does nothing unless the
+// NUMA mode is first_touch.
+void pagePrefault(void* ptr, size_t size, WorkPool* pool);
+
+// Bump allocator over page allocated chunks, individual allocations are never freed
+struct PageArena {
+  char* chunk;  // Most recent chunk, the previous ones are linked through their first bytes
+  size_t used;
+  size_t capacity;
+};
+
+void* pageArenaAlloc(PageArena* arena, size_t size);
+void pageArenaFree(PageArena* arena);
+
+#endif  // !PAGE_ALLOC_H
@@ -9,10 +9,6 @@ LICENSE file in the root directory of this source tree.
 #ifndef PLATFORM_METRICS_H
 #define PLATFORM_METRICS_H
 
-#if _WIN32
-
-#include <Windows.h>
-#include <intrin.h>
 #include <inttypes.h>
 
 typedef uint8_t uint8;
@@ -25,6 +21,19 @@ typedef int16_t int16;
 typedef int32_t int32;
 typedef int64_t int64;
 
+struct MemoryMetrics {
+  uint64 minor_faults;
+  uint64 major_faults;  // Always 0 on Windows, which only reports one count
+  uint64 rss;           // Bytes
+  uint64 peak_rss;
+};
+
+#if _WIN32
+
+#include <Windows.h>
+#include <intrin.h>
+#include <psapi.h>
+
 static uint64_t getOSTimerFreq(void) {
   LARGE_INTEGER freq;
   QueryPerformanceFrequency(&freq);
@@ -37,9 +46,25 @@ static uint64_t readOSTimer(void) {
   return value.QuadPart;
 }
 
+static MemoryMetrics readMemoryMetrics(void) {
+  PROCESS_MEMORY_COUNTERS counters = {};
+  counters.cb = sizeof(counters);
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+  MemoryMetrics result = {};
+  result.minor_faults = counters.PageFaultCount;
+  result.rss = counters.WorkingSetSize;
+  result.peak_rss = counters.PeakWorkingSetSize;
+  return result;
+}
+
 #else
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <x86intrin.h>
 
 static uint64_t getOSTimerFreq(void) { return 1000000; }
@@ -51,6 +76,35 @@ static uint64_t readOSTimer(void) {
   uint64_t result = getOSTimerFreq() * (uint64_t)value.tv_sec + (uint64_t)value.tv_usec;
   return result;
 }
+
+// Faults and the peak come from getrusage, the current RSS only from /proc/self/statm (in pages)
+static MemoryMetrics readMemoryMetrics(void) {
+  MemoryMetrics result = {};
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    result.minor_faults = usage.ru_minflt;
+    result.major_faults = usage.ru_majflt;
+    result.peak_rss = (uint64)usage.ru_maxrss * 1024;
+  }
+
+  int fd = open("/proc/self/statm", O_RDONLY);
+  if (fd >= 0) {
+    char buffer[128];
+    ssize_t len = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+
+    unsigned long long size, resident;
+    if (len > 0) {
+      buffer[len] = 0;
+      if (sscanf(buffer, "%llu %llu", &size, &resident) == 2) {
+        result.rss = resident * (uint64)sysconf(_SC_PAGESIZE);
+      }
+    }
+  }
+
+  return result;
+}
 #endif
 
 inline uint64_t readCPUTimer(void) { return __rdtsc(); }
@@ -8,4 +8,5 @@ LICENSE file in the root directory of this source tree.
 
 #include "simple_profiler.h"
 
-std::vector<BlockTimeInfo> g_timer_infos;
\ No newline at end of file
+std::vector<BlockTimeInfo> g_timer_infos;
+uint64 g_timer_overhead;
@@ -21,42 +21,90 @@ struct BlockTimeInfo {
   const char* name;
   const char* file_name;
   int line_number;
+
+  // Deltas over the block
+  uint64 minor_faults;
+  uint64 major_faults;
+  int64 rss;
+  uint64 peak_rss;
 };
 
+static void printMemoryDeltas(uint64 minor_faults, uint64 major_faults, int64 rss, uint64 peak_rss) {
+  fprintf(stdout, "  faults %llu minor, %llu major, rss %+.2f MB, peak rss +%.2f MB\n", (unsigned long long)minor_faults, (unsigned long long)major_faults, rss / (1024. * 1024.),
+          peak_rss / (1024. * 1024.));
+}
+
 extern std::vector<BlockTimeInfo> g_timer_infos;
 
+// Cycles spent reading memory metrics by every block so far
+extern uint64 g_timer_overhead;
+
+// The memory metrics cost a few syscalls. A block reads them outside of its own timed part, for
+// nested blocks the reads of the children land inside the parent and are subtracted from it.
 struct CPUTimer {
   CPUTimer(size_t idx, const char* name, const char* file_name, int line_number) : block_time_idx{idx} {
-    this->info.elapsed = readCPUTimer();
     this->info.name = name;
     this->info.file_name = file_name;
     this->info.line_number = line_number;
+
+    uint64 read_start = readCPUTimer();
+    this->memory = readMemoryMetrics();
+    this->overhead_start = g_timer_overhead;
+    this->info.elapsed = readCPUTimer();
+    this->begin_overhead = this->info.elapsed - read_start;
   }
 
   ~CPUTimer() {
-    this->info.elapsed = readCPUTimer() - this->info.elapsed;
+    uint64 end_counter = readCPUTimer();
+    this->info.elapsed = end_counter - this->info.elapsed - (g_timer_overhead - this->overhead_start);
+
+    MemoryMetrics end = readMemoryMetrics();
+    this->info.minor_faults = end.minor_faults - this->memory.minor_faults;
+    this->info.major_faults = end.major_faults - this->memory.major_faults;
+    this->info.rss = (int64)end.rss - (int64)this->memory.rss;
+    this->info.peak_rss = end.peak_rss - this->memory.peak_rss;
+
     g_timer_infos[this->block_time_idx] = this->info;
+
+    g_timer_overhead += this->begin_overhead + (readCPUTimer() - end_counter);
   }
 
   BlockTimeInfo info;
+  MemoryMetrics memory;
   size_t block_time_idx;
+  uint64 overhead_start;
+  uint64 begin_overhead;
 };
 
 struct Profiler {
-  void begin() { this->counter = readCPUTimer(); }
+  void begin() {
+    this->memory = readMemoryMetrics();
+    this->overhead_start = g_timer_overhead;
+    this->counter = readCPUTimer();
+  }
+
   void endAndPrint() {
-    uint64 total = readCPUTimer() - this->counter;
+    uint64 overhead = g_timer_overhead - this->overhead_start;
+    uint64 total = readCPUTimer() - this->counter - overhead;
+    MemoryMetrics end = readMemoryMetrics();
 
     uint64 cpu_freq = cpuTimerGuessFreq(100);
 
     fprintf(stdout, "Total time: %.4fms (CPU freq %llu)\n", (total / (double)cpu_freq) * 1000., cpu_freq);
+    fprintf(stdout, "  memory metrics overhead %.4fms, not included\n", (overhead / (double)cpu_freq) * 1000.);
+    printMemoryDeltas(end.minor_faults - this->memory.minor_faults, end.major_faults - this->memory.major_faults,
+                      (int64)end.rss - (int64)this->memory.rss, end.peak_rss - this->memory.peak_rss);
+    fprintf(stdout, "  peak rss %.2f MB\n", end.peak_rss / (1024. * 1024.));
 
     for (auto& timer : g_timer_infos) {
       fprintf(stdout, "%s: %llu (%.2f%%)\n", timer.name, timer.elapsed, (timer.elapsed / (double)total) * 100.);
+      printMemoryDeltas(timer.minor_faults, timer.major_faults, timer.rss, timer.peak_rss);
     }
   }
 
   uint64 counter;
+  uint64 overhead_start;
+  MemoryMetrics memory;
 };
 
 #define _TIME_BLOCK0(x, y) x##y
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#include "work_pool.h"
+
+static bool workPoolPop(WorkPool* pool, int worker, WorkTask* task) {
+  {
+    WorkQueue* queue = &pool->queues[worker];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.back();
+      queue->tasks.pop_back();
+      pool->queued--;
+      return true;
+    }
+  }
+
+  for (int i = 1; i < pool->worker_count; i++) {
+    WorkQueue* queue = &pool->queues[(worker + i) % pool->worker_count];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.front();
+      queue->tasks.pop_front();
+      pool->queued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void workPoolRun(WorkPool* pool, WorkTask task, int worker) {
+  task.fn(task.data, worker);
+
+  if (--pool->pending == 0) {
+    std::lock_guard<std::mutex> lock(pool->wake_mutex);
+    pool->wake.notify_all();
+  }
+}
+
+static void workPoolWorker(WorkPool* pool, int worker) {
+  for (;;) {
+    WorkTask task;
+    if (workPoolPop(pool, worker, &task)) {
+      workPoolRun(pool, task, worker);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(pool->wake_mutex);
+    pool->wake.wait(lock, [pool]() { return pool->quit || pool->queued > 0; });
+    if (pool->quit) break;
+  }
+}
+
+void workPoolInit(WorkPool* pool, int worker_count) {
+  pool->worker_count = worker_count > 0 ? worker_count : 1;
+  pool->queues = new WorkQueue[pool->worker_count];
+  pool->queued = 0;
+  pool->pending = 0;
+  pool->next_queue = 0;
+  pool->quit = false;
+
+  for (int i = 1; i < pool->worker_count; i++) {
+    pool->threads.emplace_back(workPoolWorker, pool, i);
+  }
+}
+
+void workPoolShutdown(WorkPool* pool) {
+  {
+    std::lock_guard<std::mutex> lock(pool->wake_mutex);
+    pool->quit = true;
+    pool->wake.notify_all();
+  }
+
+  for (std::thread& thread : pool->threads) {
+    thread.join();
+  }
+
+  pool->threads.clear();
+  delete[] pool->queues;
+  pool->queues = nullptr;
+}
+
+void workPoolPush(WorkPool* pool, WorkTask task, int worker) {
+  if (worker < 0) {
+    worker = pool->next_queue++ % pool->worker_count;
+  }
+
+  // Counted before the task is visible so a thief can never take `queued` below zero
+  pool->pending++;
+  pool->queued++;
+
+  {
+    WorkQueue* queue = &pool->queues[worker];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->tasks.push_back(task);
+  }
+
+  std::lock_guard<std::mutex> lock(pool->wake_mutex);
+  pool->wake.notify_one();
+}
+
+void workPoolWait(WorkPool* pool) {
+  while (pool->pending > 0) {
+    WorkTask task;
+    if (workPoolPop(pool, 0, &task)) {
+      workPoolRun(pool, task, 0);
+      continue;
+    }
+
+    // Everything left is running on other workers, wait for them or for new tasks they push
+    std::unique_lock<std::mutex> lock(pool->wake_mutex);
+    pool->wake.wait(lock, [pool]() { return pool->pending == 0 || pool->queued > 0; });
+  }
+}
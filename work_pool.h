@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2023, Fuzes Marcel
+All rights reserved.
+
+This source code is licensed under the BSD-style license found in the
+LICENSE file in the root directory of this source tree.
+*/
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Every worker owns a queue, it pops its own most recently pushed task
+// first and steals the oldest task of another worker when it runs dry. Tasks may push more tasks
+// (e.g. a file splitting itself into chunks), those go to the queue of the worker running it.
+//
+// Worker 0 is the thread calling workPoolWait, so a pool with a single worker runs everything on
+// the calling thread.
+
+struct WorkTask {
+  void (*fn)(void* data, int worker);
+  void* data;
+};
+
+struct WorkQueue {
+  std::mutex mutex;
+  std::deque<WorkTask> tasks;
+};
+
+struct WorkPool {
+  int worker_count;
+  WorkQueue* queues;
+  std::vector<std::thread> threads;
+
+  std::atomic<int64_t> queued;   // Sitting in a queue
+  std::atomic<int64_t> pending;  // Pushed but not finished yet
+  std::atomic<uint32_t> next_queue;
+  std::atomic<bool> quit;
+
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+};
+
+void workPoolInit(WorkPool* pool, int worker_count);
+void workPoolShutdown(WorkPool* pool);
+
+// `worker` is the index passed to the running task, or -1 to spread tasks over all queues
+void workPoolPush(WorkPool* pool, WorkTask task, int worker = -1);
+
+// Runs tasks on the calling thread as well until every pushed task has finished
+void workPoolWait(WorkPool* pool);
+
+#endif  // !WORK_POOL_H